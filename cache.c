@@ -1,72 +1,877 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "cache.h"
 
-static cache_entry_t *cache = NULL;
-static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
+#define NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)   //every block of the JBOD has a key, disk_num*256+block_num
+#define TAG_INVALID 0xffff      //tag of a slot that holds no block
+#define CACHE_LINE_SIZE 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
-int cache_create(int num_entries) {
-  if(cache_size!=0 || num_entries<2 || num_entries>4096)     //if cache already initialized or size is greater than 4096 or smaller than 2 then fail
+/* Links of a member inside one of the replacement policy's lists, -1 at either end. */
+typedef struct {
+  int prev;   //neighbour closer to the head (most recently inserted end)
+  int next;   //neighbour closer to the tail (next to be removed)
+} cache_link_t;
+
+/* A replacement policy. The cache itself only keeps the slots and the index,
+ * the policy decides which slot gets reused once every slot is taken. */
+typedef struct {
+  const char *name;
+  int (*init)(void);                      //sets up the policy for cache_size entries, 1 on success and -1 on failure
+  void (*destroy)(void);
+  void (*hit)(int index);                 //entry |index| was looked up or updated
+  /* returns the slot the new block |disk_num|/|block_num| goes in and links it into the policy.
+   * |free_index| is an unused slot, or -1 if the cache is full and the policy has to evict one */
+  int (*place)(int disk_num, int block_num, int free_index);
+  /* returns the slot place would most likely evict for |disk_num|/|block_num| on a full cache, without changing anything */
+  int (*victim)(int disk_num, int block_num);
+} policy_t;
+
+/*
+ * Intrusive doubly linked lists shared by the policies. Resident lists are
+ * linked through links[] and hold slot indices, ghost lists remember
+ * recently evicted blocks and are linked through ghost_links[] by key.
+ */
+typedef struct {
+  int head;
+  int tail;
+  int size;
+  cache_link_t *nodes;   //links[] or ghost_links[]
+} list_t;
+
+/*
+ * Everything one cache holds. The cache is kept as a structure of arrays.
+ * The per-slot metadata lives in dense arrays so scanning or probing it
+ * never touches block contents, and the blocks themselves sit in one cache
+ * line aligned arena, slot i at arena+i*JBOD_BLOCK_SIZE.
+ */
+struct cache {
+  uint16_t *tags;          //key of the block held by each slot, TAG_INVALID if none
+  cache_link_t *links;     //position of each slot in its policy list
+  uint8_t *queues;         //which of the policy's lists each slot is on
+  uint8_t *dirty;          //1 if a slot holds a write the JBOD has not seen yet
+  uint8_t *prefetched;     //1 if a slot was filled by read-ahead and has not been asked for yet
+  uint8_t *arena;
+  size_t arena_bytes;
+  bool arena_mapped;       //true if the arena came from mmap rather than the heap
+  int cache_size;
+  int num_used;            //number of slots handed out so far, unused slots are filled in order before anything is evicted
+  cache_write_back_t write_back;   //set while write-back caching is on
+  int num_queries;
+  int num_hits;
+  int num_prefetch_hits;   //first hits on read-ahead blocks, not counted in num_hits
+  int num_prefetched;
+  int num_prefetch_wasted; //read-ahead blocks evicted before anyone asked for them
+  /* direct-mapped index from (disk_num, block_num) to the cache slot holding it, -1 when not cached */
+  int slot_map[JBOD_NUM_DISKS][JBOD_NUM_BLOCKS_PER_DISK];
+  const policy_t *policy;
+
+  cache_link_t ghost_links[NUM_KEYS];
+  int ghost_queue[NUM_KEYS];   //which ghost list a key is on, -1 when it is on none
+
+  /* the state of each policy, only that of the policy in use means anything */
+  list_t lru_list;
+  list_t arc_t1, arc_t2, arc_b1, arc_b2;
+  int arc_p;
+  list_t twoq_a1in, twoq_am, twoq_a1out;
+  int twoq_kin;            //target size of A1in, a quarter of the cache
+  int twoq_kout;           //number of ghosts remembered by A1out, half the cache
+  uint8_t *clock_ref;      //one byte per slot, 0 or 1, so eight slots are tested with one 64 bit load
+  int clock_hand;
+  int *lfu_heap;           //slot indices in heap order
+  int *lfu_pos;            //position of each slot in lfu_heap
+  uint32_t *lfu_count;
+  uint64_t *lfu_stamp;
+  int lfu_size;
+  uint64_t lfu_tick;
+
+  /* the TinyLFU admission filter */
+  bool admission_enabled;
+  uint8_t *sketch;         //SKETCH_DEPTH rows of sketch_width counters
+  int sketch_width;        //power of two so a row index is a mask of the hash
+  int sketch_samples;
+  int num_rejected;
+};
+
+static cache_t default_cache;
+static _Thread_local cache_t *cache = &default_cache;   //the cache the calling thread works on
+
+static void *aligned_calloc(size_t count, size_t size)   //zeroed allocation starting on a cache line
+{
+  size_t bytes=(count*size+CACHE_LINE_SIZE-1)/CACHE_LINE_SIZE*CACHE_LINE_SIZE;
+  void *p=aligned_alloc(CACHE_LINE_SIZE, bytes);
+  if(p!=NULL)
+  {
+    memset(p, 0, bytes);
+  }
+  return p;
+}
+
+/* Allocates the block arena. Arenas of at least half a huge page are
+ * rounded up to whole huge pages and tried with MAP_HUGETLB first, then
+ * fall back to a huge page aligned heap allocation. Smaller arenas are
+ * only aligned to a cache line. */
+static int arena_create(int num_entries)
+{
+  size_t bytes=(size_t)num_entries*JBOD_BLOCK_SIZE;
+  size_t alignment=CACHE_LINE_SIZE;
+  if(bytes>=HUGE_PAGE_SIZE/2)
+  {
+    bytes=(bytes+HUGE_PAGE_SIZE-1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE;
+    alignment=HUGE_PAGE_SIZE;
+#ifdef MAP_HUGETLB
+    void *p=mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if(p!=MAP_FAILED)
+    {
+      cache->arena=(uint8_t*)p, cache->arena_bytes=bytes, cache->arena_mapped=true;
+      return 1;
+    }
+#endif
+  }
+  cache->arena=(uint8_t*)aligned_alloc(alignment, bytes);
+  if(cache->arena==NULL)
+  {
+    return -1;
+  }
+#ifdef MADV_HUGEPAGE
+  if(alignment==HUGE_PAGE_SIZE)
+  {
+    madvise(cache->arena, bytes, MADV_HUGEPAGE);    //no reserved huge pages, ask for transparent ones instead, failure is harmless
+  }
+#endif
+  cache->arena_bytes=bytes, cache->arena_mapped=false;
+  return 1;
+}
+
+static void arena_destroy(void)
+{
+  if(cache->arena_mapped)
+  {
+    munmap(cache->arena, cache->arena_bytes);
+  } else
+  {
+    free(cache->arena);
+  }
+  cache->arena=NULL, cache->arena_bytes=0, cache->arena_mapped=false;
+}
+
+static uint8_t *slot_block(int index)
+{
+  return cache->arena+(size_t)index*JBOD_BLOCK_SIZE;
+}
+
+static void list_init(list_t *list, cache_link_t *nodes)
+{
+  list->head=-1, list->tail=-1, list->size=0;
+  list->nodes=nodes;
+}
+
+static void list_unlink(list_t *list, int i)   //helper function that takes a member out of the list
+{
+  cache_link_t *l=&list->nodes[i];
+  if(l->prev!=-1)
+  {
+    list->nodes[l->prev].next=l->next;
+  } else
+  {
+    list->head=l->next;
+  }
+  if(l->next!=-1)
+  {
+    list->nodes[l->next].prev=l->prev;
+  } else
+  {
+    list->tail=l->prev;
+  }
+  list->size--;
+}
+
+static void list_push_front(list_t *list, int i)   //helper function that makes i the head of the list
+{
+  cache_link_t *l=&list->nodes[i];
+  l->prev=-1;
+  l->next=list->head;
+  if(list->head!=-1)
+  {
+    list->nodes[list->head].prev=i;
+  }
+  list->head=i;
+  if(list->tail==-1)
+  {
+    list->tail=i;
+  }
+  list->size++;
+}
+
+static int list_pop_back(list_t *list)   //removes and returns the tail of the list, -1 if it is empty
+{
+  int i=list->tail;
+  if(i!=-1)
+  {
+    list_unlink(list, i);
+  }
+  return i;
+}
+
+static int entry_key(int index)
+{
+  return cache->tags[index];
+}
+
+static void ghost_push(list_t *list, int queue, int key)   //remembers an evicted block on ghost list |queue|
+{
+  list_push_front(list, key);
+  cache->ghost_queue[key]=queue;
+}
+
+static void ghost_drop(list_t *list, int key)
+{
+  list_unlink(list, key);
+  cache->ghost_queue[key]=-1;
+}
+
+static void ghost_drop_oldest(list_t *list)
+{
+  if(list->tail!=-1)
+  {
+    ghost_drop(list, list->tail);
+  }
+}
+
+static void ghosts_reset(void)
+{
+  memset(cache->ghost_queue, -1, sizeof(cache->ghost_queue));
+}
+
+static void no_destroy(void)
+{
+}
+
+/* LRU: a single recency list, hits move to the head and the tail is evicted. */
+
+static int lru_init(void)
+{
+  list_init(&cache->lru_list, cache->links);
+  return 1;
+}
+
+static void lru_hit(int index)
+{
+  if(cache->lru_list.head!=index)
+  {
+    list_unlink(&cache->lru_list, index);
+    list_push_front(&cache->lru_list, index);
+  }
+}
+
+static int lru_place(int disk_num, int block_num, int free_index)
+{
+  int index=free_index!=-1 ? free_index : list_pop_back(&cache->lru_list);
+  list_push_front(&cache->lru_list, index);
+  return index;
+}
+
+static int lru_victim(int disk_num, int block_num)
+{
+  return cache->lru_list.tail;
+}
+
+static const policy_t lru_policy = { "lru", lru_init, no_destroy, lru_hit, lru_place, lru_victim };
+
+/*
+ * ARC (Megiddo and Modha): T1 holds blocks seen once recently, T2 blocks seen
+ * at least twice. B1 and B2 remember what was evicted from each, and a hit
+ * in a ghost list moves the target size p of T1 toward the list that would
+ * have kept the block.
+ */
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+
+static int arc_init(void)
+{
+  list_init(&cache->arc_t1, cache->links), list_init(&cache->arc_t2, cache->links);
+  list_init(&cache->arc_b1, cache->ghost_links), list_init(&cache->arc_b2, cache->ghost_links);
+  ghosts_reset();
+  cache->arc_p=0;
+  return 1;
+}
+
+static void arc_hit(int index)
+{
+  list_unlink(cache->queues[index]==ARC_T1 ? &cache->arc_t1 : &cache->arc_t2, index);
+  list_push_front(&cache->arc_t2, index);
+  cache->queues[index]=ARC_T2;
+}
+
+static bool arc_replace_from_t1(bool in_b2)   //true if REPLACE takes its victim from T1 rather than T2
+{
+  return cache->arc_t1.size>0 && (cache->arc_t1.size>cache->arc_p || (in_b2 && cache->arc_t1.size==cache->arc_p) || cache->arc_t2.size==0);
+}
+
+static int arc_replace(bool in_b2)   //evicts the LRU end of T1 or T2 into its ghost list and returns the freed slot
+{
+  int index;
+  if(arc_replace_from_t1(in_b2))
+  {
+    index=list_pop_back(&cache->arc_t1);
+    ghost_push(&cache->arc_b1, ARC_B1, entry_key(index));
+  } else
+  {
+    index=list_pop_back(&cache->arc_t2);
+    ghost_push(&cache->arc_b2, ARC_B2, entry_key(index));
+  }
+  return index;
+}
+
+static int arc_place(int disk_num, int block_num, int free_index)
+{
+  int key=disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num;
+  int index=free_index;
+  int queue=ARC_T2;
+  if(cache->ghost_queue[key]==ARC_B1)   //recency list was too small, grow p
+  {
+    int delta=cache->arc_b2.size>cache->arc_b1.size ? cache->arc_b2.size/cache->arc_b1.size : 1;
+    cache->arc_p=cache->arc_p+delta<cache->cache_size ? cache->arc_p+delta : cache->cache_size;
+    ghost_drop(&cache->arc_b1, key);
+    if(index==-1)
+    {
+      index=arc_replace(false);
+    }
+  } else if(cache->ghost_queue[key]==ARC_B2)   //frequency list was too small, shrink p
+  {
+    int delta=cache->arc_b1.size>cache->arc_b2.size ? cache->arc_b1.size/cache->arc_b2.size : 1;
+    cache->arc_p=cache->arc_p-delta>0 ? cache->arc_p-delta : 0;
+    ghost_drop(&cache->arc_b2, key);
+    if(index==-1)
+    {
+      index=arc_replace(true);
+    }
+  } else
+  {
+    queue=ARC_T1;
+    if(cache->arc_t1.size+cache->arc_b1.size>=cache->cache_size)
+    {
+      if(cache->arc_t1.size<cache->cache_size)
+      {
+        ghost_drop_oldest(&cache->arc_b1);
+        if(index==-1)
+        {
+          index=arc_replace(false);
+        }
+      } else if(index==-1)      //T1 fills the whole cache, its LRU block is dropped without a ghost
+      {
+        index=list_pop_back(&cache->arc_t1);
+      }
+    } else
+    {
+      if(cache->arc_t1.size+cache->arc_t2.size+cache->arc_b1.size+cache->arc_b2.size>=2*cache->cache_size)
+      {
+        ghost_drop_oldest(&cache->arc_b2);
+      }
+      if(index==-1)
+      {
+        index=arc_replace(false);
+      }
+    }
+  }
+  list_push_front(queue==ARC_T1 ? &cache->arc_t1 : &cache->arc_t2, index);
+  cache->queues[index]=queue;
+  return index;
+}
+
+static int arc_victim(int disk_num, int block_num)
+{
+  int key=disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num;
+  return arc_replace_from_t1(cache->ghost_queue[key]==ARC_B2) ? cache->arc_t1.tail : cache->arc_t2.tail;
+}
+
+static const policy_t arc_policy = { "arc", arc_init, no_destroy, arc_hit, arc_place, arc_victim };
+
+/*
+ * 2Q (Johnson and Shasha): new blocks enter the FIFO A1in and only reach the
+ * LRU list Am if they are requested again while remembered by the ghost
+ * FIFO A1out, so a single scan cannot flush Am.
+ */
+enum { TWOQ_A1IN, TWOQ_AM, TWOQ_A1OUT };
+
+static int twoq_init(void)
+{
+  list_init(&cache->twoq_a1in, cache->links), list_init(&cache->twoq_am, cache->links);
+  list_init(&cache->twoq_a1out, cache->ghost_links);
+  ghosts_reset();
+  cache->twoq_kin=cache->cache_size/4 > 0 ? cache->cache_size/4 : 1;
+  cache->twoq_kout=cache->cache_size/2 > 0 ? cache->cache_size/2 : 1;
+  return 1;
+}
+
+static void twoq_hit(int index)
+{
+  if(cache->queues[index]==TWOQ_AM)    //hits in A1in leave it alone, correlated references do not promote
+  {
+    list_unlink(&cache->twoq_am, index);
+    list_push_front(&cache->twoq_am, index);
+  }
+}
+
+static bool twoq_evict_a1in(void)   //true if the next eviction comes from A1in rather than Am
+{
+  return cache->twoq_a1in.size>cache->twoq_kin || cache->twoq_am.size==0;
+}
+
+static int twoq_place(int disk_num, int block_num, int free_index)
+{
+  int key=disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num;
+  int index=free_index;
+  if(index==-1)
+  {
+    if(twoq_evict_a1in())
+    {
+      index=list_pop_back(&cache->twoq_a1in);
+      ghost_push(&cache->twoq_a1out, TWOQ_A1OUT, entry_key(index));
+      if(cache->twoq_a1out.size>cache->twoq_kout)
+      {
+        ghost_drop_oldest(&cache->twoq_a1out);
+      }
+    } else
+    {
+      index=list_pop_back(&cache->twoq_am);
+    }
+  }
+  if(cache->ghost_queue[key]==TWOQ_A1OUT)    //seen again after leaving A1in, it is hot
+  {
+    ghost_drop(&cache->twoq_a1out, key);
+    list_push_front(&cache->twoq_am, index);
+    cache->queues[index]=TWOQ_AM;
+  } else
+  {
+    list_push_front(&cache->twoq_a1in, index);
+    cache->queues[index]=TWOQ_A1IN;
+  }
+  return index;
+}
+
+static int twoq_victim(int disk_num, int block_num)
+{
+  return twoq_evict_a1in() ? cache->twoq_a1in.tail : cache->twoq_am.tail;
+}
+
+static const policy_t twoq_policy = { "2q", twoq_init, no_destroy, twoq_hit, twoq_place, twoq_victim };
+
+/* CLOCK: slots form a ring with a reference bit each, the hand clears set bits until it finds a clear one to evict. */
+
+#define CLOCK_REF_WORD 0x0101010101010101ULL   //eight set reference bits
+
+static int clock_init(void)
+{
+  cache->clock_ref=(uint8_t*)aligned_calloc(cache->cache_size, sizeof(uint8_t));
+  cache->clock_hand=0;
+  return cache->clock_ref==NULL ? -1 : 1;
+}
+
+static void clock_destroy(void)
+{
+  free(cache->clock_ref);
+  cache->clock_ref=NULL;
+}
+
+static void clock_hit(int index)
+{
+  cache->clock_ref[index]=1;
+}
+
+static bool clock_word_referenced(int index)   //true if the eight slots starting at aligned |index| are all referenced
+{
+  uint64_t word;
+  if(index%8!=0 || index+8>cache->cache_size)
+  {
+    return false;
+  }
+  memcpy(&word, cache->clock_ref+index, sizeof(word));
+  return word==CLOCK_REF_WORD;
+}
+
+static int clock_place(int disk_num, int block_num, int free_index)
+{
+  int index=free_index;
+  if(index==-1)
+  {
+    while(true)    //second chance for every referenced entry
+    {
+      if(clock_word_referenced(cache->clock_hand))    //skip a whole word of referenced slots at once
+      {
+        memset(cache->clock_ref+cache->clock_hand, 0, 8);
+        cache->clock_hand=(cache->clock_hand+8)%cache->cache_size;
+      } else if(cache->clock_ref[cache->clock_hand])
+      {
+        cache->clock_ref[cache->clock_hand]=0;
+        cache->clock_hand=(cache->clock_hand+1)%cache->cache_size;
+      } else
+      {
+        break;
+      }
+    }
+    index=cache->clock_hand;
+    cache->clock_hand=(cache->clock_hand+1)%cache->cache_size;
+  }
+  cache->clock_ref[index]=0;
+  return index;
+}
+
+static int clock_victim(int disk_num, int block_num)
+{
+  int i=0;
+  while(i<cache->cache_size)    //first clear bit ahead of the hand, or the hand itself once a full sweep has cleared every bit
+  {
+    int index=(cache->clock_hand+i)%cache->cache_size;
+    if(clock_word_referenced(index))
+    {
+      i+=8;
+    } else if(cache->clock_ref[index])
+    {
+      i++;
+    } else
+    {
+      return index;
+    }
+  }
+  return cache->clock_hand;
+}
+
+static const policy_t clock_policy = { "clock", clock_init, clock_destroy, clock_hit, clock_place, clock_victim };
+
+/* LFU: a binary min-heap of slots ordered by use count, ties broken by least recent use. */
+
+static int lfu_init(void)
+{
+  cache->lfu_heap=(int*)malloc(cache->cache_size*sizeof(int));
+  cache->lfu_pos=(int*)malloc(cache->cache_size*sizeof(int));
+  cache->lfu_count=(uint32_t*)malloc(cache->cache_size*sizeof(uint32_t));
+  cache->lfu_stamp=(uint64_t*)malloc(cache->cache_size*sizeof(uint64_t));
+  cache->lfu_size=0, cache->lfu_tick=0;
+  if(cache->lfu_heap==NULL || cache->lfu_pos==NULL || cache->lfu_count==NULL || cache->lfu_stamp==NULL)
   {
     return -1;
+  }
+  return 1;
+}
+
+static void lfu_destroy(void)
+{
+  free(cache->lfu_heap), free(cache->lfu_pos), free(cache->lfu_count), free(cache->lfu_stamp);
+  cache->lfu_heap=NULL, cache->lfu_pos=NULL, cache->lfu_count=NULL, cache->lfu_stamp=NULL;
+}
+
+static bool lfu_before(int a, int b)    //true if slot a should be evicted before slot b
+{
+  if(cache->lfu_count[a]!=cache->lfu_count[b])
+  {
+    return cache->lfu_count[a]<cache->lfu_count[b];
+  }
+  return cache->lfu_stamp[a]<cache->lfu_stamp[b];
+}
+
+static void lfu_swap(int i, int j)
+{
+  int tmp=cache->lfu_heap[i];
+  cache->lfu_heap[i]=cache->lfu_heap[j], cache->lfu_heap[j]=tmp;
+  cache->lfu_pos[cache->lfu_heap[i]]=i, cache->lfu_pos[cache->lfu_heap[j]]=j;
+}
+
+static void lfu_sift_down(int i)
+{
+  while(true)
+  {
+    int smallest=i;
+    int left=2*i+1, right=2*i+2;
+    if(left<cache->lfu_size && lfu_before(cache->lfu_heap[left], cache->lfu_heap[smallest]))
+    {
+      smallest=left;
+    }
+    if(right<cache->lfu_size && lfu_before(cache->lfu_heap[right], cache->lfu_heap[smallest]))
+    {
+      smallest=right;
+    }
+    if(smallest==i)
+    {
+      return;
+    }
+    lfu_swap(i, smallest);
+    i=smallest;
+  }
+}
+
+static void lfu_sift_up(int i)
+{
+  while(i>0 && lfu_before(cache->lfu_heap[i], cache->lfu_heap[(i-1)/2]))
+  {
+    lfu_swap(i, (i-1)/2);
+    i=(i-1)/2;
+  }
+}
+
+static void lfu_hit(int index)
+{
+  cache->lfu_count[index]++;
+  cache->lfu_stamp[index]=++cache->lfu_tick;
+  lfu_sift_down(cache->lfu_pos[index]);   //the count only grows, so the entry can only move away from the root
+}
+
+static int lfu_place(int disk_num, int block_num, int free_index)
+{
+  int index=free_index;
+  if(index==-1)    //reuse the root's slot in place
+  {
+    index=cache->lfu_heap[0];
   } else
   {
-    cache=(cache_entry_t*)malloc(num_entries*sizeof(cache_entry_t));  //allocating an array of size num_entries to cache
-    cache_size=num_entries;    //update cache_size
+    cache->lfu_heap[cache->lfu_size]=index;
+    cache->lfu_pos[index]=cache->lfu_size++;
+  }
+  cache->lfu_count[index]=1;
+  cache->lfu_stamp[index]=++cache->lfu_tick;
+  lfu_sift_up(cache->lfu_pos[index]);
+  lfu_sift_down(cache->lfu_pos[index]);
+  return index;
+}
+
+static int lfu_victim(int disk_num, int block_num)
+{
+  return cache->lfu_heap[0];
+}
+
+static const policy_t lfu_policy = { "lfu", lfu_init, lfu_destroy, lfu_hit, lfu_place, lfu_victim };
+
+/*
+ * TinyLFU admission (Einziger, Friedman and Manes): a count-min sketch
+ * estimates how often each block was asked for recently. Once the cache is
+ * full a missed block is only inserted if it is estimated to be wanted more
+ * often than the entry the policy would evict for it. Every counter is halved
+ * after SKETCH_SAMPLES_PER_ENTRY*cache_size recorded lookups so old
+ * popularity fades out.
+ */
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX_COUNT 15    //4 bit counters are enough to tell hot blocks from cold ones
+#define SKETCH_SAMPLES_PER_ENTRY 10
+
+static const uint32_t sketch_seeds[SKETCH_DEPTH] = { 0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f };
+
+static int sketch_init(void)
+{
+  cache->sketch_width=64;
+  while(cache->sketch_width<4*cache->cache_size)
+  {
+    cache->sketch_width*=2;
+  }
+  cache->sketch=(uint8_t*)calloc(SKETCH_DEPTH*cache->sketch_width, sizeof(uint8_t));
+  cache->sketch_samples=0;
+  return cache->sketch==NULL ? -1 : 1;
+}
+
+static void sketch_destroy(void)
+{
+  free(cache->sketch);
+  cache->sketch=NULL;
+}
+
+static int sketch_slot(int row, int key)
+{
+  uint32_t h=((uint32_t)key+1)*sketch_seeds[row];
+  return row*cache->sketch_width+((h>>16^h)&(cache->sketch_width-1));
+}
+
+static int sketch_estimate(int key)    //smallest counter across the rows
+{
+  int estimate=SKETCH_MAX_COUNT;
+  for(int row=0; row<SKETCH_DEPTH; row++)
+  {
+    if(cache->sketch[sketch_slot(row, key)]<estimate)
+    {
+      estimate=cache->sketch[sketch_slot(row, key)];
+    }
+  }
+  return estimate;
+}
+
+static void sketch_record(int key)
+{
+  for(int row=0; row<SKETCH_DEPTH; row++)
+  {
+    uint8_t *counter=&cache->sketch[sketch_slot(row, key)];
+    if(*counter<SKETCH_MAX_COUNT)
+    {
+      (*counter)++;
+    }
+  }
+  if(++cache->sketch_samples>=SKETCH_SAMPLES_PER_ENTRY*cache->cache_size)    //aging, halve every counter
+  {
+    for(int i=0; i<SKETCH_DEPTH*cache->sketch_width; i++)
+    {
+      cache->sketch[i]>>=1;
+    }
+    cache->sketch_samples/=2;
+  }
+}
+
+int cache_set_admission(bool enable)
+{
+  if(cache->cache_size==0 || enable==cache->admission_enabled)
+  {
+    return cache->cache_size==0 ? -1 : 1;
+  }
+  if(enable && sketch_init()==-1)
+  {
+    return -1;
+  }
+  if(!enable)
+  {
+    sketch_destroy();
+  }
+  cache->admission_enabled=enable;
+  return 1;
+}
+
+static const policy_t *policies[CACHE_NUM_POLICIES] = {
+  [CACHE_POLICY_LRU] = &lru_policy,
+  [CACHE_POLICY_ARC] = &arc_policy,
+  [CACHE_POLICY_2Q] = &twoq_policy,
+  [CACHE_POLICY_CLOCK] = &clock_policy,
+  [CACHE_POLICY_LFU] = &lfu_policy,
+};
+
+int cache_policy_by_name(const char *name)
+{
+  for(int i=0; i<CACHE_NUM_POLICIES; i++)
+  {
+    if(strcmp(name, policies[i]->name)==0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int cache_create_with_policy(int num_entries, cache_policy_t policy_id) {
+  if(cache->cache_size!=0 || num_entries<2 || num_entries>4096)     //if cache already initialized or size is greater than 4096 or smaller than 2 then fail
+  {
+    return -1;
+  } else if(policy_id<0 || policy_id>=CACHE_NUM_POLICIES)
+  {
+    return -1;
+  } else
+  {
+    cache->cache_size=num_entries;    //update cache_size
+    cache->tags=(uint16_t*)aligned_calloc(num_entries, sizeof(uint16_t));
+    cache->links=(cache_link_t*)aligned_calloc(num_entries, sizeof(cache_link_t));
+    cache->queues=(uint8_t*)aligned_calloc(num_entries, sizeof(uint8_t));
+    cache->dirty=(uint8_t*)aligned_calloc(num_entries, sizeof(uint8_t));
+    cache->prefetched=(uint8_t*)aligned_calloc(num_entries, sizeof(uint8_t));
+    if(cache->tags==NULL || cache->links==NULL || cache->queues==NULL || cache->dirty==NULL || cache->prefetched==NULL || arena_create(num_entries)==-1)
+    {
+      cache_destroy();
+      return -1;
+    }
+    memset(cache->tags, 0xff, num_entries*sizeof(uint16_t));    //every slot starts invalid
+    memset(cache->slot_map, -1, sizeof(cache->slot_map));    //no block is cached yet
+    cache->num_used=0, cache->num_rejected=0;
+    cache->num_prefetched=0, cache->num_prefetch_hits=0, cache->num_prefetch_wasted=0;
+    cache->policy=policies[policy_id];
+    if(cache->policy->init()==-1)
+    {
+      cache_destroy();
+      return -1;
+    }
     return 1;
   }
 }
 
+cache_t *cache_new(void)
+{
+  return (cache_t*)calloc(1, sizeof(cache_t));     //no entries, so it counts as not created
+}
+
+void cache_free(cache_t *c)
+{
+  if(c==NULL)
+  {
+    return;
+  }
+  cache_t *previous=cache_select(c);
+  if(cache->cache_size!=0)
+  {
+    cache_destroy();
+  }
+  cache_select(previous);
+  free(c);
+}
+
+cache_t *cache_select(cache_t *c)
+{
+  cache_t *previous=cache;
+  cache=c!=NULL ? c : &default_cache;
+  return previous;
+}
+
+int cache_create(int num_entries) {
+  return cache_create_with_policy(num_entries, CACHE_POLICY_LRU);
+}
+
 int cache_destroy(void) {
-  if(cache_size==0)     //no cache is intialized, fail
+  if(cache->cache_size==0)     //no cache is intialized, fail
   {
     return -1;
   }else
   {
-    free(cache);         //deallocate cache and set it back to null
-    cache=NULL;
-    cache_size=0;        //update cache_size when destroyed
+    if(cache->policy!=NULL)
+    {
+      cache->policy->destroy();
+    }
+    cache_set_admission(false);
+    free(cache->tags), free(cache->links), free(cache->queues), free(cache->dirty), free(cache->prefetched);         //deallocate cache and set it back to null, dirty entries are dropped
+    cache->tags=NULL, cache->links=NULL, cache->queues=NULL, cache->dirty=NULL, cache->prefetched=NULL;
+    cache->write_back=NULL;
+    arena_destroy();
+    cache->cache_size=0;        //update cache_size when destroyed
     return 1;
   }
 }
 
 int detect_duplicate(int disk_num, int block_num)//helper function that returns the index number of cache entry of disk_num and block_num
 {
-  if(cache_size!=0)
+  if(cache->cache_size==0 || disk_num<0 || disk_num>=JBOD_NUM_DISKS || block_num<0 || block_num>=JBOD_NUM_BLOCKS_PER_DISK)
   {
-    int i=0;
-    while(cache[i].valid==true)   //while loop to check for matching entry
-    {
-      if(cache[i].disk_num==disk_num && cache[i].block_num==block_num)
-      {
-        return i;
-      }
-      i++;
-    }
+    return -1;
   }
-  return -1;       //if no match found, return -1
+  return cache->slot_map[disk_num][block_num];       //constant time regardless of how full the cache is, -1 if no match
 }
 
 int cache_lookup(int disk_num, int block_num, uint8_t *buf)
 {
-  num_queries++;      //increment num_queries regardless of output
-  if(cache_size==0 || buf==NULL)
+  cache->num_queries++;      //increment num_queries regardless of output
+  if(cache->cache_size==0 || buf==NULL)
   {
     return -1;
   } else
   {
     int match_index=detect_duplicate(disk_num,block_num);     //get match entry index
+    if(cache->admission_enabled && disk_num>=0 && disk_num<JBOD_NUM_DISKS && block_num>=0 && block_num<JBOD_NUM_BLOCKS_PER_DISK)
+    {
+      sketch_record(disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num);   //hits and misses both count toward popularity
+    }
     if(match_index!=-1)                 //checks if there is a match or not
     {
-      if(cache[match_index].valid==true){
-        memcpy(buf,cache[match_index].block, 256);    //if there is am match, copy its block content into buf
-        num_hits++, clock++;       //update clock and num_hit
-        cache[match_index].access_time=clock;        //update its access_time
+      if(cache->tags[match_index]!=TAG_INVALID){
+        memcpy(buf,slot_block(match_index), 256);    //if there is am match, copy its block content into buf
+        if(cache->prefetched[match_index])    //read-ahead paid off, counted apart from demand hits
+        {
+          cache->prefetched[match_index]=0;
+          cache->num_prefetch_hits++;
+        } else
+        {
+          cache->num_hits++;       //update num_hit
+        }
+        cache->policy->hit(match_index);
         return 1;
       }
     }
@@ -74,31 +879,43 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf)
   }
 }
 
-int get_lru_index()      //helper function to get the least recently used entry index in the cache array
+void cache_update(int disk_num, int block_num, const uint8_t *buf)
 {
-  int lru_index=0;
-  for(int i=0; i<cache_size; i++)   //start searching from the beginning of the cache
+  int dup_index=detect_duplicate(disk_num, block_num);
+  if(dup_index!=-1)     //if there is a match, update the entry
   {
-    if(cache[i].access_time<cache[lru_index].access_time)
-    {
-      lru_index=i;
-    }
+    memcpy(slot_block(dup_index),buf,256);
+    cache->policy->hit(dup_index);
   }
-  return lru_index;        //if there is any cache entry that is not valid, it will return its index to fill up the cache before replacing valid entry
 }
 
-void cache_update(int disk_num, int block_num, const uint8_t *buf) 
+/* helper function that stores a block that is not cached yet in a free or evicted slot, returned in |index|.
+ * A dirty victim is written back first; returns -1 if that failed and the victim's write was lost, 1 otherwise */
+static int fill_slot(int disk_num, int block_num, const uint8_t *buf, int *index)
 {
-  int dup_index=detect_duplicate(disk_num, block_num);
-  if(dup_index!=-1)     //if there is a match, update the entry
+  int rc=1;
+  int free_index=cache->num_used<cache->cache_size ? cache->num_used++ : -1;   //unused entries are filled before replacing valid entry
+  int insert_index=cache->policy->place(disk_num, block_num, free_index);
+  if(cache->tags[insert_index]!=TAG_INVALID)   //evicting a valid entry, drop it from the index
   {
-    memcpy(cache[dup_index].block,buf,256);
-    cache[dup_index].access_time=clock;
+    int old_disk=cache->tags[insert_index]/JBOD_NUM_BLOCKS_PER_DISK, old_block=cache->tags[insert_index]%JBOD_NUM_BLOCKS_PER_DISK;
+    if(cache->dirty[insert_index] && cache->write_back(old_disk, old_block, slot_block(insert_index))==-1)
+    {
+      rc=-1;
+    }
+    cache->slot_map[old_disk][old_block]=-1;
+    cache->num_prefetch_wasted+=cache->prefetched[insert_index];
   }
+  cache->slot_map[disk_num][block_num]=insert_index;
+  cache->tags[insert_index]=disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num;
+  cache->dirty[insert_index]=0, cache->prefetched[insert_index]=0;
+  memcpy(slot_block(insert_index),buf,256);
+  *index=insert_index;
+  return rc;
 }
 
 int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
-  if(buf==NULL || cache==NULL)     //fail if buf is NULL and cache is not initialized
+  if(buf==NULL || cache->cache_size==0)     //fail if buf is NULL and cache is not initialized
   {
     return -1;
   } else if(disk_num>15 || disk_num<0 || block_num>255 || block_num<0) //checks for out of bound disk and block argument
@@ -111,21 +928,115 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
       return -1;
     } else
     {
-      clock++;
-      int insert_index=get_lru_index();   //get the least recently used, if there are invalid entry, that will be use first before replacing valid entry
-      cache[insert_index].disk_num=disk_num;
-      cache[insert_index].block_num=block_num;
-      cache[insert_index].valid=true;
-      cache[insert_index].access_time=clock;
-      memcpy(cache[insert_index].block,buf,256);
-      return 1;
+      if(cache->admission_enabled && cache->num_used==cache->cache_size)
+      {
+        int victim_index=cache->policy->victim(disk_num, block_num);
+        if(sketch_estimate(disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num)<=sketch_estimate(entry_key(victim_index)))
+        {
+          cache->num_rejected++;
+          return 0;       //the victim is at least as popular, keep it
+        }
+      }
+      int insert_index;
+      return fill_slot(disk_num, block_num, buf, &insert_index);
     }
   }
 }
 
-bool cache_enabled(void) 
+bool cache_contains(int disk_num, int block_num)
 {
-  if(cache_size>1)   //if cache is initialized, return true
+  return detect_duplicate(disk_num, block_num)!=-1;
+}
+
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf)
+{
+  int rc=cache_insert(disk_num, block_num, buf);
+  if(rc==1)
+  {
+    cache->prefetched[cache->slot_map[disk_num][block_num]]=1;
+    cache->num_prefetched++;
+  }
+  return rc;
+}
+
+void cache_prefetch_stats(int *hits, int *wasted)
+{
+  *hits=cache->num_prefetch_hits;
+  *wasted=cache->num_prefetch_wasted;
+}
+
+int cache_set_write_back(cache_write_back_t fn)
+{
+  if(cache->cache_size==0)
+  {
+    return -1;
+  }
+  if(fn==NULL && cache->write_back!=NULL && cache_flush()==-1)    //nothing may stay dirty once writes go straight through
+  {
+    return -1;
+  }
+  cache->write_back=fn;
+  return 1;
+}
+
+bool cache_write_back_enabled(void)
+{
+  return cache->write_back!=NULL;
+}
+
+int cache_write(int disk_num, int block_num, const uint8_t *buf)
+{
+  if(buf==NULL || cache->write_back==NULL)
+  {
+    return -1;
+  } else if(disk_num>15 || disk_num<0 || block_num>255 || block_num<0)
+  {
+    return -1;
+  }
+  int rc=1;
+  int index=detect_duplicate(disk_num, block_num);
+  if(index!=-1)
+  {
+    memcpy(slot_block(index),buf,256);
+    cache->policy->hit(index);
+  } else
+  {
+    rc=fill_slot(disk_num, block_num, buf, &index);   //dirty data is never turned away by the admission filter
+  }
+  cache->dirty[index]=1;
+  return rc;
+}
+
+int cache_flush(void)
+{
+  int rc=1;
+  if(cache->write_back==NULL)
+  {
+    return 1;
+  }
+  for(int disk_num=0; disk_num<JBOD_NUM_DISKS; disk_num++)    //walk in address order so the write backs seek forward
+  {
+    for(int block_num=0; block_num<JBOD_NUM_BLOCKS_PER_DISK; block_num++)
+    {
+      int i=cache->slot_map[disk_num][block_num];
+      if(i!=-1 && cache->dirty[i])
+      {
+        if(cache->write_back(disk_num, block_num, slot_block(i))==-1)
+        {
+          rc=-1;    //keep it dirty and carry on with the rest
+        } else
+        {
+          cache->dirty[i]=0;
+        }
+      }
+    }
+  }
+  return rc;
+}
+
+bool cache_enabled(void)
+{
+  if(cache->cache_size>1)   //if cache is initialized, return true
   {
     return true;
   }
@@ -133,5 +1044,14 @@ bool cache_enabled(void)
 }
 
 void cache_print_hit_rate(void) {
-  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
+  fprintf(stderr, "Hit rate: %5.1f%% (%s%s)\n", 100 * (float) cache->num_hits / cache->num_queries, cache->policy!=NULL ? cache->policy->name : "none", cache->admission_enabled ? "+tinylfu" : "");
+  if(cache->num_prefetched>0)
+  {
+    fprintf(stderr, "Prefetch hit rate: %5.1f%% (%d of %d read-ahead blocks used, %d evicted unused)\n",
+            100 * (float) cache->num_prefetch_hits / cache->num_queries, cache->num_prefetch_hits, cache->num_prefetched, cache->num_prefetch_wasted);
+  }
+  if(cache->admission_enabled)
+  {
+    fprintf(stderr, "Admission rejected: %d\n", cache->num_rejected);
+  }
 }
@@ -7,19 +7,48 @@
 #include "jbod.h"
 #include "util.h"
 
-typedef struct {
-  bool valid;
-  int disk_num;
-  int block_num;
-  uint8_t block[JBOD_BLOCK_SIZE];
-  int access_time;
-} cache_entry_t;
+/* One cache with its own blocks, policy and statistics. The functions below
+ * take no cache argument, they work on the cache the calling thread
+ * selected, or on a default one shared by every thread that selected none.
+ * A cache is for one thread at a time. */
+typedef struct cache cache_t;
+
+/* Returns a new cache handle, NULL on failure. The cache in it still has to
+ * be created with cache_create once it is selected. */
+cache_t *cache_new(void);
+
+/* Destroys whatever the cache in |c| holds and frees the handle. It must
+ * not be selected by any thread. */
+void cache_free(cache_t *c);
+
+/* Makes |c| the cache the calling thread works on, NULL for the default one.
+ * Returns the one it replaces. */
+cache_t *cache_select(cache_t *c);
+
+/* Replacement policies the cache can be created with. */
+typedef enum {
+  CACHE_POLICY_LRU,
+  CACHE_POLICY_ARC,
+  CACHE_POLICY_2Q,
+  CACHE_POLICY_CLOCK,
+  CACHE_POLICY_LFU,
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
 
 /* Returns 1 on success and -1 on failure. Should allocate a space for
- * |num_entries| cache entries, each of type cache_entry_t. Calling it again
- * without first calling cache_destroy (see below) should fail. */
+ * |num_entries| cache entries: dense per-entry metadata arrays and a cache
+ * line aligned arena for the blocks. Calling it again without first calling
+ * cache_destroy (see below) should fail. */
 int cache_create(int num_entries);
 
+/* Same as cache_create, but entries are replaced according to |policy|
+ * instead of least recently used. */
+int cache_create_with_policy(int num_entries, cache_policy_t policy);
+
+/* Returns the policy called |name| ("lru", "arc", "2q", "clock" or "lfu"),
+ * or -1 if there is no such policy. */
+int cache_policy_by_name(const char *name);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
  * cache_create function above. */
 int cache_destroy(void);
@@ -29,6 +58,10 @@ int cache_destroy(void);
  * contents to buf. */
 int cache_lookup(int disk_num, int block_num, uint8_t *buf);
 
+/* Returns true if the block located at |disk_num| and |block_num| is cached.
+ * Unlike cache_lookup it does not count as a query or touch the entry. */
+bool cache_contains(int disk_num, int block_num);
+
 /* Returns 1 on success and -1 on failure. Inserts an entry for |disk_num| and
  * |block_num| into cache. If there is already an existing entry in the cache
  * with |disk_num| and |block_num|, should update its value with data provided
@@ -38,10 +71,47 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns 1 on success and -1 on failure. Turns the TinyLFU admission filter
+ * on or off for the current cache. While it is on, cache_insert on a full
+ * cache returns 0 without inserting when the block is not estimated to be
+ * requested more often than the entry it would replace. */
+int cache_set_admission(bool enable);
+
+/* Same as cache_insert, but marks the entry as read ahead. The first lookup
+ * that hits it is counted as a prefetch hit instead of a demand hit. */
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf);
+
+/* Stores the number of read-ahead entries that were hit in |hits| and the
+ * number evicted before they were ever looked up in |wasted|. */
+void cache_prefetch_stats(int *hits, int *wasted);
+
+/* Writes a dirty block back to the JBOD. Returns 1 on success and -1 on failure. */
+typedef int (*cache_write_back_t)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns 1 on success and -1 on failure. A non-NULL |fn| turns write-back
+ * caching on: cache_write keeps blocks dirty in the cache and |fn| is called
+ * to write them out when they are evicted or flushed. NULL flushes every
+ * dirty block and turns it back off. cache_destroy drops dirty blocks, so
+ * call cache_flush first. */
+int cache_set_write_back(cache_write_back_t fn);
+
+/* Returns true if write-back caching is on. */
+bool cache_write_back_enabled(void);
+
+/* Returns 1 on success and -1 on failure. Stores |buf| as the new contents of
+ * block |block_num| of disk |disk_num| and marks it dirty, inserting it if it
+ * is not cached yet. Only valid while write-back caching is on. */
+int cache_write(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns 1 on success and -1 on failure. Writes every dirty block back and
+ * marks it clean. */
+int cache_flush(void);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Prints the hit rate of the cache along with the policy that produced it,
+ * and the prefetch hit rate if anything was read ahead. */
 void cache_print_hit_rate(void);
 
 #endif
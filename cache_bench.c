@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "cache.h"
+#include "jbod.h"
+
+/*
+ * Microbenchmark for the block cache on its own, no JBOD server needed.
+ * For every policy and cache size it times lookups that hit, inserts that
+ * have to evict, and updates of cached blocks, and prints nanoseconds per
+ * call.
+ */
+
+#define BENCH_ARGUMENTS "hn:"
+#define USAGE                                                  \
+  "USAGE: cache_bench [-h] [-n operations]\n"                  \
+  "\n"                                                         \
+  "where:\n"                                                   \
+  "    -h - help mode (display this message)\n"                \
+  "    -n - number of operations timed per measurement\n"      \
+  "\n"                                                         \
+
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift so every run and every policy sees the same access sequence */
+static uint32_t next_rand(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void bench(cache_policy_t policy, const char *name, int size, int ops) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  uint32_t seed = 0x2545f491;
+  double start, lookup_ns, insert_ns, update_ns;
+
+  memset(buf, 0xab, sizeof(buf));
+  if (cache_create_with_policy(size, policy) != 1)
+    errx(1, "Failed to create cache.");
+
+  for (int i = 0; i < size; ++i)
+    cache_insert(i / JBOD_NUM_BLOCKS_PER_DISK, i % JBOD_NUM_BLOCKS_PER_DISK, buf);
+
+  /* every block looked up is cached */
+  start = now_ns();
+  for (int i = 0; i < ops; ++i) {
+    int key = next_rand(&seed) % size;
+    cache_lookup(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, buf);
+  }
+  lookup_ns = (now_ns() - start) / ops;
+
+  start = now_ns();
+  for (int i = 0; i < ops; ++i) {
+    int key = next_rand(&seed) % size;
+    cache_update(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, buf);
+  }
+  update_ns = (now_ns() - start) / ops;
+
+  /* a miss followed by an insert, the cache stays full so each one evicts */
+  start = now_ns();
+  for (int i = 0; i < ops; ++i) {
+    int key = next_rand(&seed) % NUM_BLOCKS;
+    if (cache_lookup(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, buf) == -1)
+      cache_insert(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, buf);
+  }
+  insert_ns = (now_ns() - start) / ops;
+
+  cache_destroy();
+  printf("%-6s %5d  lookup %7.1f ns  update %7.1f ns  miss+insert %7.1f ns\n",
+         name, size, lookup_ns, update_ns, insert_ns);
+}
+
+int main(int argc, char *argv[]) {
+  const char *names[CACHE_NUM_POLICIES] = { "lru", "arc", "2q", "clock", "lfu" };
+  const int sizes[] = { 64, 1024, 4096 };
+  int ch, ops = 1000000;
+
+  while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'n':
+        ops = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  for (int p = 0; p < CACHE_NUM_POLICIES; ++p)
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+      bench(cache_policy_by_name(names[p]), names[p], sizes[s], ops);
+
+  return 0;
+}
@@ -13,15 +13,102 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
 #include "cache.h"
 #include "mdadm.h"
 #include "util.h"
 #include "jbod.h"
 #include "net.h"
-//declared a variable to keep track of whether the JBOD is mounted or not, started as not mounted.
-int IS_MOUNTED=0;
+
+#define JBOD_SPACE_SIZE (JBOD_NUM_DISKS*JBOD_DISK_SIZE)    //bytes in the whole address space
+
+//where the next byte goes in, or comes out of, an iovec list
+typedef struct
+{
+  const struct iovec *iov;
+  int iovcnt;
+  int seg;           //current segment
+  size_t off;        //bytes of it already used
+} iov_cursor_t;
+
+//a block read still on the wire. Neither the cache nor the caller sees it before complete_reads, which then inserts it
+//and copies the wanted part out through |cur|
+typedef struct
+{
+  int disk_num, block_num;
+  uint8_t *data;          //where the response lands, the caller's buffer for a whole block or a staging block
+  uint8_t *copy_to;       //the caller's buffer when an extent had to land in the staging block instead
+  bool prefetch;
+  iov_cursor_t cur;
+  uint32_t offset, len;   //part of the block the caller wants, len 0 when it landed in the caller's buffer already
+} staged_read_t;
+
+#define MAX_STAGED JBOD_MAX_WINDOW
+
+//a block write-through write waiting in the coalescing buffer
+typedef struct
+{
+  int disk_num, block_num;
+  uint32_t lo, hi;        //bytes of data that were written, the whole block once its old contents were merged in
+  uint8_t data[256];
+} pending_write_t;
+
+//everything one user of the JBOD works with. The connection and the cache it uses are its own too, selected along with it
+struct mdadm_ctx
+{
+  int IS_MOUNTED;           //whether the JBOD is mounted or not
+  //client side model of the JBOD head on each connection of the pool, -1 when unknown. Seeks are only sent when the head is not
+  //already where the next read or write needs it
+  int head_disk[JBOD_MAX_CONNECTIONS];
+  int head_block[JBOD_MAX_CONNECTIONS];
+  cache_t *cache;           //NULL for the default cache and connection
+  jbod_net_t *net;
+
+  //read-ahead state: a run of consecutive blocks is a stream, once one is seen the next prefetch_window blocks are read along with a miss
+  int readahead_max;        //largest window, 0 turns read-ahead off
+  int prefetch_window;
+  int last_block_key;       //disk_num*256+block_num of the last block read or written
+  int stream_run;           //how many consecutive blocks led up to it
+  int last_prefetch_hits, last_prefetch_wasted;
+
+  //async rings: submissions wait in sq until the caller waits for a completion, then the whole batch runs and lands in cq.
+  //both are indexed by free running counters modulo async_entries
+  mdadm_sqe_t *async_sq;
+  mdadm_cqe_t *async_cq;
+  struct iovec *async_iov;  //one per submission slot, reads of a batch scatter through it after the batch is sent
+  int async_entries;
+  uint32_t sq_head, sq_tail, cq_head, cq_tail;
+  uint32_t *async_order;    //submissions of the batch being run, in the order the scheduler runs them
+  mdadm_sched_t async_scheduler;
+  int sched_head;           //disk_num*256+block_num where the last batch left the head
+  bool sched_up;            //which way the SCAN sweep is going
+
+  //write coalescing: write-through writes wait here, one entry per block, and later writes to a block merge into its
+  //entry. They go out when the buffer is full, before a read of their block, and on flush or unmount
+  pending_write_t pending_writes[JBOD_MAX_WINDOW];
+  int coalesce_max;         //entries in use before the buffer is flushed, 0 turns coalescing off
+  int num_pending_writes;
+
+  //block reads sent but not completed yet
+  staged_read_t staged[MAX_STAGED];
+  uint8_t staging[MAX_STAGED][256];
+  int num_staged;
+  int run_start;            //staged reads from here on are a run of blocks not sent yet, they go out as one extent
+
+  //blocks written through to a server that takes extents wait here while they follow each other, then go out as one
+  uint8_t write_run[JBOD_MAX_EXTENT][256];
+  int write_run_disk, write_run_block, write_run_len;
+};
+
+#define MDADM_CTX_INIT { .prefetch_window=1, .last_block_key=-1, .sched_up=true }
+
+static mdadm_ctx_t default_ctx=MDADM_CTX_INIT;
+static _Thread_local mdadm_ctx_t *ctx=&default_ctx;    //the context the calling thread works on
+
+int coalesce_flush(void);
 
 //defined a function to that takes disk_ID, block_ID and enum command and combines them to create an uint32_t op
 uint32_t encode_operation(int disk_ID, int block_ID, int command)
@@ -31,6 +118,15 @@ uint32_t encode_operation(int disk_ID, int block_ID, int command)
   return op;
 }
 
+//forgets where every head is
+void reset_heads(void)
+{
+  for(int i=0; i<JBOD_MAX_CONNECTIONS; i++)
+  {
+    ctx->head_disk[i]=-1, ctx->head_block[i]=-1;
+  }
+}
+
 //defines mount operation
 int mdadm_mount(void) {
   //creates uint32_t op that uses JBOD_MOUNT to mount the disk and passed it in the given jbod_client_operation() function
@@ -42,23 +138,39 @@ int mdadm_mount(void) {
     return -1;
   } else
   {
-    IS_MOUNTED=1;
+    ctx->IS_MOUNTED=1;
+    ctx->num_pending_writes=0;      //anything a failed unmount left behind is dropped
+    reset_heads();    //nothing is known about the head of a freshly mounted JBOD
     return 1;
   }
 }
 
+//marks the context mounted without a MOUNT of its own, the JBOD answering a seek shows someone else mounted it already
+int mdadm_attach(void)
+{
+  if(ctx->IS_MOUNTED==1 || jbod_client_operation(encode_operation(0,0,JBOD_SEEK_TO_DISK), NULL)==-1)
+  {
+    return -1;
+  }
+  ctx->IS_MOUNTED=1;
+  ctx->num_pending_writes=0;
+  reset_heads();
+  return 1;
+}
+
 //defines unmount operation
 int mdadm_unmount(void) {
   //creates uint32_t op that uses JBOD_UNMOUNT to unmount the disks and passed it in the given jbod_client_operation() function
   // since unmount ignores disk and block number, I used 0 and 0 as their value since it doesn;t  matter
   uint32_t unmount_op=encode_operation(0,0, JBOD_UNMOUNT);
-  //checks if unmount fails, return -1
-  if(jbod_client_operation(unmount_op, NULL)==-1)
+  //dirty cache entries have to reach the disks before they go away, then checks if unmount fails, return -1
+  if(coalesce_flush()==-1 || cache_flush()==-1 || jbod_client_operation(unmount_op, NULL)==-1)
   {
     return -1;
   } else
   {
-    IS_MOUNTED=0;
+    ctx->IS_MOUNTED=0;
+    reset_heads();
     return 1;
   }
 }
@@ -80,116 +192,763 @@ int get_block_num(uint32_t addr)
 
 //method that takes in integer disk number and construct the uint32_t operation to seek to that specific disk number
 //It is important to call this before changing block number since block number resets to 0- after changing disk
+//the seek is skipped if the head is already on that disk, callers that need a particular block seek to it afterwards
 int go_to_disk(int disk_num)
 {
+  int conn=jbod_connection_for(disk_num);
+  if(ctx->head_disk[conn]==disk_num)
+  {
+    return 1;
+  }
   uint32_t change_disk_op=encode_operation(disk_num,0, JBOD_SEEK_TO_DISK);
   //set returns value for debugging, the return values aren't used by the program.
-  if(jbod_client_operation(change_disk_op, NULL)==-1)
+  if(jbod_client_submit(change_disk_op, NULL)==-1)
   {
+    ctx->head_disk[conn]=-1, ctx->head_block[conn]=-1;
     return -1;
   }
+  ctx->head_disk[conn]=disk_num, ctx->head_block[conn]=0;
   return 1;
 }
 
 //method that takes in integer block number and construct the uint32_t operation to seek to that specific block number
-int go_to_block(int block_num)
+//the seek is skipped if the head is already on that block. The server ignores the disk field of this and of reads and
+//writes, the client sends them on the connection of |disk_num| by it
+int go_to_block(int disk_num, int block_num)
 {
-  uint32_t change_block_op=encode_operation(0, block_num, JBOD_SEEK_TO_BLOCK);
+  int conn=jbod_connection_for(disk_num);
+  if(ctx->head_disk[conn]!=-1 && ctx->head_block[conn]==block_num)
+  {
+    return 1;
+  }
+  uint32_t change_block_op=encode_operation(disk_num, block_num, JBOD_SEEK_TO_BLOCK);
   //set returns value for debugging, the return values aren't used by the program.
-  if(jbod_client_operation(change_block_op, NULL)==-1)
+  if(jbod_client_submit(change_block_op, NULL)==-1)
   {
+    ctx->head_block[conn]=-1;
     return -1;
   }
+  ctx->head_block[conn]=block_num;
   return 1;
 }
 
-//defined method that takes in a uint8_t buffer and copy the entire current block into that buffer at the current disk and block.
-//important that buffer must be size 256 since blokc size is 256
-int read_block(uint8_t* buf)
+//puts the head on |block_num| of |disk_num| with as few seeks as the current position allows
+int seek_to(int disk_num, int block_num)
 {
-  uint32_t read_op=encode_operation(0, 0, JBOD_READ_BLOCK);
-  //set returns value for debugging, the return values aren't used by the program.
-  if(jbod_client_operation(read_op, buf)==-1)
+  if(go_to_disk(disk_num)==-1 || go_to_block(disk_num, block_num)==-1)
   {
     return -1;
   }
   return 1;
 }
 
+//the server moves to the next block after every read or write, past the last block of a disk the position is unknown
+void advance_head(int conn)
+{
+  ctx->head_block[conn]=(ctx->head_block[conn]==-1 || ctx->head_block[conn]+1>=JBOD_NUM_BLOCKS_PER_DISK) ? -1 : ctx->head_block[conn]+1;
+}
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
-  // if statement to check if mounted, if read length is not greater than 1024 byte, and end address is not out of bound
-  if(addr+len>1048575 || IS_MOUNTED==0 || len>1024)
+//reads or writes (|command|) block |block_num| of |disk_num| with |buf|. When the head is elsewhere and the server
+//takes compound operations the seeks travel in the same request, otherwise they go out ahead of it as needed.
+//|count| blocks from there on go in one extent request, only for servers that take those
+int transfer_block(int disk_num, int block_num, int count, int command, uint8_t* buf)
+{
+  int conn=jbod_connection_for(disk_num);
+  uint32_t op;
+  if(count>1)
+  {
+    op=encode_operation(disk_num, block_num, command==JBOD_READ_BLOCK ? JBOD_READ_EXTENT : JBOD_WRITE_EXTENT) | count;
+    ctx->head_disk[conn]=disk_num, ctx->head_block[conn]=block_num+count-1;      //the last block moves it on like a single transfer
+  } else if((ctx->head_disk[conn]!=disk_num || ctx->head_block[conn]!=block_num) && jbod_has_feature(JBOD_FEATURE_COMPOUND))
+  {
+    op=encode_operation(disk_num, block_num, command==JBOD_READ_BLOCK ? JBOD_SEEK_AND_READ : JBOD_SEEK_AND_WRITE);
+    ctx->head_disk[conn]=disk_num, ctx->head_block[conn]=block_num;
+  } else
   {
+    if(seek_to(disk_num, block_num)==-1)
+    {
+      return -1;
+    }
+    op=encode_operation(disk_num, 0, command);
+  }
+  //set returns value for debugging, the return values aren't used by the program.
+  if(jbod_client_submit(op, buf)==-1)
+  {
+    ctx->head_disk[conn]=-1, ctx->head_block[conn]=-1;
     return -1;
-  } else if (buf==NULL && len!=0)       //if statement checks for buf is NULL and read length is not 0, which it should fail
+  }
+  advance_head(conn);
+  return 1;
+}
+
+//defined method that takes in a uint8_t buffer and copy block |block_num| of |disk_num| into that buffer.
+//important that buffer must be size 256 since blokc size is 256. The block only lands in buf once the pipeline is drained
+int read_block(int disk_num, int block_num, uint8_t* buf)
+{
+  return transfer_block(disk_num, block_num, 1, JBOD_READ_BLOCK, buf);
+}
+
+//function writing buff to block |block_num| of |disk_num|, the block is copied out when it is sent so buf can be reused right away
+int write_block(int disk_num, int block_num, uint8_t* buf)
+{
+  return transfer_block(disk_num, block_num, 1, JBOD_WRITE_BLOCK, buf);
+}
+
+//writes the |len| bytes of |buf| at |offset| into block |block_num| of |disk_num| without reading the rest of the block,
+//the server patches them in. Only for servers that take partial writes, the seek travels in the same request
+int write_partial(int disk_num, int block_num, uint32_t offset, uint32_t len, const uint8_t *buf)
+{
+  int conn=jbod_connection_for(disk_num);
+  uint8_t payload[256];
+  payload[0]=offset;
+  memcpy(payload+1, buf, len);
+  if(jbod_client_submit(encode_operation(disk_num, block_num, JBOD_WRITE_PARTIAL) | (len-1), payload)==-1)
   {
+    ctx->head_disk[conn]=-1, ctx->head_block[conn]=-1;
     return -1;
+  }
+  ctx->head_disk[conn]=disk_num, ctx->head_block[conn]=block_num;
+  advance_head(conn);
+  return 1;
+}
+
+//returns the coalesced write waiting for |block_num| of |disk_num|, NULL if there is none
+pending_write_t *pending_write(int disk_num, int block_num)
+{
+  for(int i=0; i<ctx->num_pending_writes; i++)
+  {
+    if(ctx->pending_writes[i].disk_num==disk_num && ctx->pending_writes[i].block_num==block_num)
+    {
+      return &ctx->pending_writes[i];
+    }
+  }
+  return NULL;
+}
+
+//sends the coalesced write |w| and takes it out of the buffer, a whole block as one write and anything less as a
+//partial write
+int send_pending_write(pending_write_t *w)
+{
+  int rc;
+  if(w->hi-w->lo==256)
+  {
+    rc=write_block(w->disk_num, w->block_num, w->data);
   } else
   {
-    uint8_t temporary[256];                      //declare temporary buffer that is 256 byte long
-
-    int disk_num=get_disk_num(addr);             //declare disk_num of the the given address argument
-    int block_num=get_block_num(addr);           //declare block_num of the the given address argument
-    
-    go_to_disk(disk_num);                        //call to seek to disk specified by the starting address and prepare for read
-    go_to_block(block_num);
-    if(cache_lookup(disk_num,block_num,temporary)==-1)
-    {
-      read_block(temporary);
-      cache_insert(disk_num,block_num,temporary);  
-    }             
-    //code segment to filter out only the wanted bytes
-    int index=0;                   //declare index variables of the buffer that will be read, starting at buff[0]
-    for(int i=addr; i<addr+len; i++)    //for loops to read from starting address to end address
-    {
-      int j=i%256;          //j specifies the current byte number in the current block that will be read to buff from temporary, can never be greater than 255
-      //if statement to check for the end of disk and disk transition
-      //will be check first compare to block transition because once we change disk, there is no need to change block since it wll reset to 0
-      disk_num=get_disk_num(i);
-      block_num=get_block_num(i); 
-      if(i%65536==0 && i!=0)
+    rc=write_partial(w->disk_num, w->block_num, w->lo, w->hi-w->lo, w->data+w->lo);
+  }
+  *w=ctx->pending_writes[--ctx->num_pending_writes];
+  return rc;
+}
+
+//returns the current segment if the next |len| bytes all sit in it and moves past them, NULL if they are split up
+uint8_t *iov_take(iov_cursor_t *cur, uint32_t len)
+{
+  while(cur->seg<cur->iovcnt && cur->off==cur->iov[cur->seg].iov_len)    //empty or used up segments
+  {
+    cur->seg++, cur->off=0;
+  }
+  if(cur->seg==cur->iovcnt || cur->iov[cur->seg].iov_len-cur->off<len)
+  {
+    return NULL;
+  }
+  uint8_t *p=(uint8_t *)cur->iov[cur->seg].iov_base+cur->off;
+  cur->off+=len;
+  return p;
+}
+
+//copies |len| bytes from |src| out to the iovec list, a NULL |src| only moves the cursor past them
+void iov_scatter(iov_cursor_t *cur, const uint8_t *src, uint32_t len)
+{
+  while(len>0)
+  {
+    size_t n=cur->iov[cur->seg].iov_len-cur->off;
+    if(n==0)
+    {
+      cur->seg++, cur->off=0;
+      continue;
+    }
+    n=n<len ? n : len;
+    if(src!=NULL)
+    {
+      memcpy((uint8_t *)cur->iov[cur->seg].iov_base+cur->off, src, n);
+      src+=n;
+    }
+    cur->off+=n, len-=n;
+  }
+}
+
+//copies |len| bytes from the iovec list into |dst|
+void iov_gather(iov_cursor_t *cur, uint8_t *dst, uint32_t len)
+{
+  while(len>0)
+  {
+    size_t n=cur->iov[cur->seg].iov_len-cur->off;
+    if(n==0)
+    {
+      cur->seg++, cur->off=0;
+      continue;
+    }
+    n=n<len ? n : len;
+    memcpy(dst, (const uint8_t *)cur->iov[cur->seg].iov_base+cur->off, n);
+    cur->off+=n, dst+=n, len-=n;
+  }
+}
+
+//adds up the segment lengths, -1 if a segment has no buffer or the list runs past the end of the JBOD from |addr|
+int64_t iov_total(uint32_t addr, const struct iovec *iov, int iovcnt)
+{
+  int64_t total=0;
+  if(iovcnt<0 || (iov==NULL && iovcnt>0))
+  {
+    return -1;
+  }
+  for(int i=0; i<iovcnt; i++)
+  {
+    if(iov[i].iov_base==NULL && iov[i].iov_len!=0)
+    {
+      return -1;
+    }
+    if(iov[i].iov_len>JBOD_SPACE_SIZE || (total+=iov[i].iov_len)>JBOD_SPACE_SIZE)
+    {
+      return -1;
+    }
+  }
+  if((int64_t)addr+total>JBOD_SPACE_SIZE)
+  {
+    return -1;
+  }
+  return total;
+}
+
+
+bool is_staged(int disk_num, int block_num)
+{
+  for(int i=0; i<ctx->num_staged; i++)
+  {
+    if(ctx->staged[i].disk_num==disk_num && ctx->staged[i].block_num==block_num)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//sends the run of staged reads that is still open. The extent lands straight in the callers' buffers when they follow
+//each other in memory, otherwise in the staging blocks, which follow each other as the staged reads do
+int send_run(void)
+{
+  int count=ctx->num_staged-ctx->run_start;
+  staged_read_t *first=&ctx->staged[ctx->run_start];
+  if(count==0)
+  {
+    return 1;
+  }
+  for(int i=1; i<count; i++)
+  {
+    if(first[i].data!=first->data+i*256)
+    {
+      for(int j=0; j<count; j++)
       {
-        go_to_disk(disk_num);                        //call to seek to disk specified by the starting address and prepare for read
-        if(cache_lookup(disk_num,block_num,temporary)==-1)//checks in cache for specified block
+        if(first[j].data!=ctx->staging[ctx->run_start+j])
         {
-          read_block(temporary);
-          cache_insert(disk_num,block_num,temporary);  
-        }       
-      } else if(j==0 && i!=0)
+          first[j].copy_to=first[j].data, first[j].data=ctx->staging[ctx->run_start+j];
+        }
+      }
+      break;
+    }
+  }
+  ctx->run_start=ctx->num_staged;
+  return transfer_block(first->disk_num, first->block_num, count, JBOD_READ_BLOCK, first->data);
+}
+
+//puts a block that was read or written whole into the cache. Returns -1 only if a dirty block it evicted could not be
+//written back, there is nothing to do without a cache or for a block that is cached already
+int cache_block(int disk_num, int block_num, const uint8_t *buf, bool prefetch)
+{
+  if(!cache_enabled() || cache_contains(disk_num,block_num))
+  {
+    return 1;
+  }
+  int rc=prefetch ? cache_insert_prefetch(disk_num,block_num,buf) : cache_insert(disk_num,block_num,buf);
+  return rc==-1 ? -1 : 1;
+}
+
+//waits for everything on the wire, then hands the staged blocks to the cache and the caller in the order they were read
+int complete_reads(void)
+{
+  int n=ctx->num_staged;
+  int sent=send_run();
+  ctx->num_staged=0, ctx->run_start=0;      //cache inserts can evict dirty blocks, whose write backs go out behind this batch
+  if(jbod_client_drain()==-1 || sent==-1)
+  {
+    reset_heads();    //some request failed, where the heads stopped is unknown
+    return -1;
+  }
+  int rc=1;
+  for(int i=0; i<n; i++)
+  {
+    staged_read_t *r=&ctx->staged[i];
+    if(r->copy_to!=NULL)
+    {
+      memcpy(r->copy_to, r->data, 256);
+    }
+    if(cache_block(r->disk_num, r->block_num, r->data, r->prefetch)==-1)     //the caller still gets the blocks, the failure is reported
+    {
+      rc=-1;
+    }
+    if(r->len>0)
+    {
+      iov_scatter(&r->cur, r->data+r->offset, r->len);
+    }
+  }
+  return rc;
+}
+
+//sends the seeks and the read for |block_num| of |disk_num| without waiting. The block lands in |direct| when that is
+//the caller's buffer, otherwise in a staging block whose bytes from |offset| on are copied out through |cur|.
+//A server that takes extents gets the read once the block after it is known not to follow on, together with the
+//reads for the blocks before it on the same disk
+int stage_read(int disk_num, int block_num, uint8_t *direct, iov_cursor_t *cur, uint32_t offset, uint32_t len, bool prefetch)
+{
+  if(ctx->num_staged==MAX_STAGED && complete_reads()==-1)
+  {
+    return -1;
+  }
+  if(ctx->num_staged>ctx->run_start && (ctx->staged[ctx->num_staged-1].disk_num!=disk_num || ctx->staged[ctx->num_staged-1].block_num+1!=block_num
+     || ctx->num_staged-ctx->run_start==JBOD_MAX_EXTENT) && send_run()==-1)
+  {
+    return -1;
+  }
+  staged_read_t *r=&ctx->staged[ctx->num_staged];
+  r->data=direct!=NULL ? direct : ctx->staging[ctx->num_staged];
+  r->copy_to=NULL;
+  if(!jbod_has_feature(JBOD_FEATURE_EXTENT))
+  {
+    if(read_block(disk_num, block_num, r->data)==-1)
+    {
+      return -1;
+    }
+    ctx->run_start=ctx->num_staged+1;
+  }
+  r->disk_num=disk_num, r->block_num=block_num, r->prefetch=prefetch;
+  r->offset=offset, r->len=0;
+  if(direct==NULL && cur!=NULL)
+  {
+    r->cur=*cur, r->len=len;
+    iov_scatter(cur, NULL, len);      //the caller carries on with the bytes after this block
+  }
+  ctx->num_staged++;
+  return 1;
+}
+
+//writes a dirty cache entry back to its block, every read and write seeks for itself so the head is left where it ends up
+int write_back_block(int disk_num, int block_num, const uint8_t *buf)
+{
+  uint8_t temporary[256];
+  memcpy(temporary, buf, 256);
+  if(write_block(disk_num, block_num, temporary)==-1)
+  {
+    return -1;
+  }
+  return 1;
+}
+
+int mdadm_set_writeback(bool enable)
+{
+  //the coalescing buffer is bypassed while write-back is on, so whatever waits in it goes out first
+  if(coalesce_flush()==-1 || complete_reads()==-1)
+  {
+    return -1;
+  }
+  return cache_set_write_back(enable ? write_back_block : NULL);
+}
+
+int mdadm_flush(void)
+{
+  if(!cache_write_back_enabled() && ctx->num_pending_writes==0)     //nothing can be dirty
+  {
+    return 1;
+  }
+  if(ctx->IS_MOUNTED==0)
+  {
+    return -1;
+  }
+  if(coalesce_flush()==-1 || cache_flush()==-1)
+  {
+    return -1;
+  }
+  return complete_reads();      //the write backs are only done once the server has answered them
+}
+
+
+//follows the access stream, a block right after the previous one extends the run and anything else starts a new one
+void track_stream(int disk_num, int block_num)
+{
+  int key=disk_num*JBOD_NUM_BLOCKS_PER_DISK+block_num;
+  if(key==ctx->last_block_key+1)
+  {
+    ctx->stream_run++;
+  } else if(key!=ctx->last_block_key)
+  {
+    ctx->stream_run=1;
+  }
+  ctx->last_block_key=key;
+}
+
+//grows the window while read-ahead blocks get used and shrinks it when they are evicted unused
+void adapt_prefetch_window(void)
+{
+  int hits, wasted;
+  cache_prefetch_stats(&hits, &wasted);
+  if(wasted-ctx->last_prefetch_wasted>hits-ctx->last_prefetch_hits)
+  {
+    ctx->prefetch_window=ctx->prefetch_window>1 ? ctx->prefetch_window/2 : 1;
+  } else if(hits>ctx->last_prefetch_hits)
+  {
+    ctx->prefetch_window=ctx->prefetch_window*2<ctx->readahead_max ? ctx->prefetch_window*2 : ctx->readahead_max;
+  }
+  ctx->last_prefetch_hits=hits, ctx->last_prefetch_wasted=wasted;
+}
+
+//the head sits right after |block_num| following a read, so the next blocks of a stream cost one read each without seeking.
+//stops at the end of the disk or at the first block that is already cached or on its way
+void prefetch_after(int disk_num, int block_num)
+{
+  adapt_prefetch_window();
+  for(int i=1; i<=ctx->prefetch_window && block_num+i<JBOD_NUM_BLOCKS_PER_DISK; i++)
+  {
+    if(!cache_enabled() || cache_contains(disk_num, block_num+i) || is_staged(disk_num, block_num+i)
+       || pending_write(disk_num, block_num+i)!=NULL || stage_read(disk_num, block_num+i, NULL, NULL, 0, 0, true)==-1)
+    {
+      return;
+    }
+  }
+}
+
+//fetch_block for the coalesced write of the block itself, which merges into what is on the disk without sending it first
+int load_block(int disk_num, int block_num, uint8_t *buf)
+{
+  track_stream(disk_num, block_num);
+  if(is_staged(disk_num, block_num) && complete_reads()==-1)
+  {
+    return -1;
+  }
+  if(cache_lookup(disk_num,block_num,buf)==1)
+  {
+    return 1;
+  }
+  if(stage_read(disk_num, block_num, buf, NULL, 0, 0, false)==-1)
+  {
+    return -1;
+  }
+  return complete_reads();
+}
+
+//gets |block_num| of |disk_num| into |buf|, out of the cache or with a read that is waited for
+int fetch_block(int disk_num, int block_num, uint8_t *buf)
+{
+  pending_write_t *w=pending_write(disk_num,block_num);
+  if(w!=NULL && send_pending_write(w)==-1)       //the read goes out behind the write it has to see
+  {
+    return -1;
+  }
+  return load_block(disk_num,block_num,buf);
+}
+
+int mdadm_set_readahead(int max_blocks)
+{
+  if(max_blocks<0 || max_blocks>JBOD_NUM_BLOCKS_PER_DISK)
+  {
+    return -1;
+  }
+  ctx->readahead_max=max_blocks;
+  ctx->prefetch_window=max_blocks<2 ? max_blocks : 2;
+  return 1;
+}
+
+//reads |len| bytes starting at |addr| into the iovec list one block at a time, in address order so the head only
+//seeks where the range starts and where it crosses onto the next disk. Cached blocks are copied right away, the reads for
+//the others are all sent before any response is waited for, and they are only in the buffers after complete_reads
+int read_range(uint32_t addr, uint32_t len, iov_cursor_t *cur)
+{
+  uint8_t temporary[256];                      //staging block for a partial block or one split across segments
+  uint32_t read_addr=addr;                     //address of the next byte to read
+  uint32_t end_addr=addr+len;
+
+  while(read_addr<end_addr)      //one iteration per block
+  {
+    int disk_num=get_disk_num(read_addr);
+    int block_num=get_block_num(read_addr);
+    uint32_t offset=read_addr%256;
+    uint32_t read_len=256-offset;              //rest of this block, or less if the read ends inside it
+    uint8_t *direct;
+    if(read_len>end_addr-read_addr)
+    {
+      read_len=end_addr-read_addr;
+    }
+    track_stream(disk_num,block_num);
+    if(is_staged(disk_num,block_num) && complete_reads()==-1)     //read ahead earlier in this range
+    {
+      return -1;
+    }
+    pending_write_t *w=pending_write(disk_num,block_num);
+    if(w!=NULL && send_pending_write(w)==-1)       //the read goes out behind the write it has to see
+    {
+      return -1;
+    }
+    direct=read_len==256 ? iov_take(cur,256) : NULL;      //whole block, the cache or the JBOD fills the caller's buffer directly
+    if(cache_lookup(disk_num,block_num,direct!=NULL ? direct : temporary)==1)
+    {
+      if(direct==NULL)
       {
-        go_to_block(block_num);
-        if(cache_lookup(disk_num,block_num,temporary)==-1)//checks in cache for specified block
-        {
-          read_block(temporary);
-          cache_insert(disk_num,block_num,temporary);  
-        }       
+        iov_scatter(cur,temporary+offset,read_len);
+      }
+    } else
+    {
+      if(stage_read(disk_num,block_num,direct,cur,offset,read_len,false)==-1)
+      {
+        return -1;
+      }
+      if(ctx->readahead_max>0 && ctx->stream_run>=2)
+      {
+        prefetch_after(disk_num, block_num);
       }
-      //code to read temporary array into buff
-      buf[index]=temporary[j];
-      index++;
     }
+    read_addr+=read_len;
   }
-  return len;
+  return 1;
+}
+
+int send_write_run(void)
+{
+  int count=ctx->write_run_len;
+  ctx->write_run_len=0;
+  if(count==0)
+  {
+    return 1;
+  }
+  return transfer_block(ctx->write_run_disk, ctx->write_run_block, count, JBOD_WRITE_BLOCK, ctx->write_run[0]);
 }
 
-int write_block(uint8_t* buf)
+//writes |buf| to |block_num| of |disk_num| right away, or adds it to the run of blocks going out as one extent
+int queue_write(int disk_num, int block_num, uint8_t *buf)
 {
-  //function writing buff to the current block
-  uint32_t write_op=encode_operation(0, 0, JBOD_WRITE_BLOCK);
-  if(jbod_client_operation(write_op, buf)==-1)
+  if(!jbod_has_feature(JBOD_FEATURE_EXTENT))
+  {
+    return write_block(disk_num, block_num, buf);
+  }
+  if(ctx->write_run_len>0 && (ctx->write_run_disk!=disk_num || ctx->write_run_block+ctx->write_run_len!=block_num
+     || ctx->write_run_len==JBOD_MAX_EXTENT) && send_write_run()==-1)
   {
     return -1;
   }
+  if(ctx->write_run_len==0)
+  {
+    ctx->write_run_disk=disk_num, ctx->write_run_block=block_num;
+  }
+  memcpy(ctx->write_run[ctx->write_run_len++], buf, 256);
   return 1;
 }
 
+int compare_pending_writes(const void *a, const void *b)
+{
+  const pending_write_t *x=a, *y=b;
+  return (x->disk_num*256+x->block_num)-(y->disk_num*256+y->block_num);
+}
+
+//sends every coalesced write in address order, so whole blocks that follow each other go out as extents
+int coalesce_flush(void)
+{
+  int rc=1;
+  qsort(ctx->pending_writes, ctx->num_pending_writes, sizeof(pending_write_t), compare_pending_writes);
+  for(int i=0; i<ctx->num_pending_writes && rc==1; i++)
+  {
+    pending_write_t *w=&ctx->pending_writes[i];
+    if(w->hi-w->lo==256)
+    {
+      rc=queue_write(w->disk_num, w->block_num, w->data);
+    } else if(send_write_run()==-1 || write_partial(w->disk_num, w->block_num, w->lo, w->hi-w->lo, w->data+w->lo)==-1)
+    {
+      rc=-1;
+    }
+  }
+  ctx->num_pending_writes=0;
+  if(send_write_run()==-1)
+  {
+    return -1;
+  }
+  return rc;
+}
+
+//merges |len| bytes from the iovec list into the coalesced write for |block_num| of |disk_num| at |offset|. The old
+//contents of the block are only read when the bytes written would not follow on from what is there already, or when
+//the server cannot take partial writes. The cache sees the block once all of it is known
+int coalesce_write(int disk_num, int block_num, uint32_t offset, uint32_t len, iov_cursor_t *cur)
+{
+  pending_write_t *w=pending_write(disk_num,block_num);
+  if(is_staged(disk_num,block_num) && complete_reads()==-1)     //the older contents must not reach the cache after the new ones
+  {
+    return -1;
+  }
+  if(w==NULL)
+  {
+    if(ctx->num_pending_writes==ctx->coalesce_max && coalesce_flush()==-1)
+    {
+      return -1;
+    }
+    w=&ctx->pending_writes[ctx->num_pending_writes++];
+    w->disk_num=disk_num, w->block_num=block_num;
+    w->lo=offset, w->hi=offset;
+  }
+  if(w->hi-w->lo<256 && len<256 && (offset>w->hi || offset+len<w->lo || !jbod_has_feature(JBOD_FEATURE_PARTIAL)
+     || cache_contains(disk_num,block_num)))
+  {
+    uint8_t old[256];
+    if(load_block(disk_num,block_num,old)==-1)
+    {
+      if(w->hi==w->lo)     //nothing was written to the entry just taken
+      {
+        ctx->num_pending_writes--;
+      }
+      return -1;
+    }
+    memcpy(old+w->lo, w->data+w->lo, w->hi-w->lo);
+    memcpy(w->data, old, 256);
+    w->lo=0, w->hi=256;
+  } else
+  {
+    track_stream(disk_num,block_num);
+  }
+  iov_gather(cur,w->data+offset,len);
+  w->lo=offset<w->lo ? offset : w->lo;
+  w->hi=offset+len>w->hi ? offset+len : w->hi;
+  if(w->hi-w->lo==256)
+  {
+    if(cache_contains(disk_num,block_num))
+    {
+      cache_update(disk_num,block_num,w->data);
+    } else if(cache_block(disk_num,block_num,w->data,false)==-1)
+    {
+      return -1;
+    }
+  }
+  return 1;
+}
+
+int mdadm_set_write_coalescing(int max_blocks)
+{
+  if(max_blocks<0 || max_blocks>JBOD_MAX_WINDOW || coalesce_flush()==-1)
+  {
+    return -1;
+  }
+  ctx->coalesce_max=max_blocks;
+  return 1;
+}
+
+//writes |len| bytes from the iovec list starting at |addr|, partial blocks are read first so the rest of them survives
+int write_range(uint32_t addr, uint32_t len, iov_cursor_t *cur)
+{
+  uint8_t temporary[256];
+  uint32_t write_addr=addr;      //the starting address to write for each block everytime write_block operation is called
+  uint32_t end_addr=addr+len;
+
+  ctx->write_run_len=0;      //whatever a failed call left unsent is dropped along with it
+
+  while(write_addr<end_addr)     //one iteration per block
+  {
+    int disk_num=get_disk_num(write_addr);       //disk transitions need no special case, write_block seeks wherever it needs to
+    int block_num=get_block_num(write_addr);
+    uint32_t offset=write_addr%256;
+    uint32_t write_len=256-offset;
+    if(write_len>end_addr-write_addr)
+    {
+      write_len=end_addr-write_addr;
+    }
+    if(ctx->coalesce_max>0 && !cache_write_back_enabled())
+    {
+      if(coalesce_write(disk_num,block_num,offset,write_len,cur)==-1)
+      {
+        return -1;
+      }
+      write_addr+=write_len;
+      continue;
+    }
+    if(write_len==256)      //the whole block is overwritten, so its old contents are never read
+    {
+      track_stream(disk_num,block_num);
+      if(is_staged(disk_num,block_num) && complete_reads()==-1)     //the older contents must not reach the cache after the new ones
+      {
+        return -1;
+      }
+    } else if(jbod_has_feature(JBOD_FEATURE_PARTIAL) && !cache_write_back_enabled() && !cache_contains(disk_num,block_num)
+              && !is_staged(disk_num,block_num))
+    {
+      //the rest of an uncached block is not read just to be sent back, only the written bytes go out and nothing is cached
+      track_stream(disk_num,block_num);
+      iov_gather(cur,temporary,write_len);
+      if(send_write_run()==-1 || write_partial(disk_num,block_num,offset,write_len,temporary)==-1)
+      {
+        return -1;
+      }
+      write_addr+=write_len;
+      continue;
+    } else if(fetch_block(disk_num,block_num,temporary)==-1)   //blocks about to be overwritten are not worth reading ahead for
+    {
+      return -1;
+    }
+    iov_gather(cur,temporary+offset,write_len);
+    if(cache_write_back_enabled())
+    {
+      if(cache_write(disk_num,block_num,temporary)==-1)    //the block only reaches the disk once it is evicted or flushed
+      {
+        return -1;
+      }
+    } else
+    {
+      if(queue_write(disk_num,block_num,temporary)==-1)     //no round trip if the head is already there
+      {
+        return -1;
+      }
+      if(cache_contains(disk_num,block_num))
+      {
+        cache_update(disk_num,block_num,temporary);    //everytime write is called, update the corresponding entry in cache with new write data
+      } else if(cache_block(disk_num,block_num,temporary,false)==-1)    //a full block write skipped the read that would have cached it
+      {
+        return -1;
+      }
+    }
+    write_addr+=write_len;
+  }
+  return send_write_run();
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+  // if statement to check if mounted, if read length is not greater than 1024 byte, and end address is not out of bound
+  if(addr+len>1048575 || ctx->IS_MOUNTED==0 || len>1024)
+  {
+    return -1;
+  } else if (buf==NULL && len!=0)       //if statement checks for buf is NULL and read length is not 0, which it should fail
+  {
+    return -1;
+  } else
+  {
+    struct iovec iov={ .iov_base=buf, .iov_len=len };
+    iov_cursor_t cur={ &iov, 1, 0, 0 };
+    if(read_range(addr,len,&cur)==-1 || complete_reads()==-1)
+    {
+      return -1;
+    }
+  }
+  return len;
+}
+
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) 
 {
   if(buf==NULL && len==0)          //checking case where buf is NULL and len is 0 and do nothing
   {
     return len;
-  } else if(addr+len-1>1048575 || IS_MOUNTED==0 || len>1024)        //checking for out of bound writing condition
+  } else if(addr+len-1>1048575 || ctx->IS_MOUNTED==0 || len>1024)        //checking for out of bound writing condition
   {
     return -1;
   } else if (buf==NULL && len!=0)        //  checking fail case where buf is NULL yet read len is not 0
@@ -197,51 +956,300 @@ int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf)
     return -1;
   } else
   {
-    uint8_t temporary[256];         
-    int current_block_lbound=addr-addr%256;         //declare variable to keep track of the starting bit number for the current block for writting
-    int current_block_ubound=current_block_lbound+255;       //declare variable to keep track of the ending bit number for the current block for writting
-    int write_addr=addr;      //the starting address to write for each block everytime write_block operation is called
-    int buff_idx=0;         //variable to keep track of the given buffer index
-    int write_len=0;
-    int end_addr=addr+len;    //variable representing the end write address, use to terminate while loop for writing purposes
-
-    int disk_num=get_disk_num(addr);
-    int block_num=get_block_num(addr);
-    go_to_disk(disk_num);                       
-    go_to_block(block_num); 
-    while(write_addr<end_addr)     //while loop to start writing
-    {
-      disk_num=get_disk_num(write_addr);
-      block_num=get_block_num(write_addr);
-      if(write_addr%65536==0)     //checks for disk transition
+    struct iovec iov={ .iov_base=(void *)buf, .iov_len=len };
+    iov_cursor_t cur={ &iov, 1, 0, 0 };
+    if(write_range(addr,len,&cur)==-1 || complete_reads()==-1)
+    {
+      return -1;
+    }
+  }
+  return len;
+}
+
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt)
+{
+  int64_t len=iov_total(addr,iov,iovcnt);
+  if(ctx->IS_MOUNTED==0 || len==-1)
+  {
+    return -1;
+  }
+  iov_cursor_t cur={ iov, iovcnt, 0, 0 };
+  if(read_range(addr,len,&cur)==-1 || complete_reads()==-1)
+  {
+    return -1;
+  }
+  return len;
+}
+
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt)
+{
+  int64_t len=iov_total(addr,iov,iovcnt);
+  if(ctx->IS_MOUNTED==0 || len==-1)
+  {
+    return -1;
+  }
+  iov_cursor_t cur={ iov, iovcnt, 0, 0 };
+  if(write_range(addr,len,&cur)==-1 || complete_reads()==-1)
+  {
+    return -1;
+  }
+  return len;
+}
+
+
+int mdadm_async_setup(int entries)
+{
+  if(ctx->async_entries!=0 || entries<1)
+  {
+    return -1;
+  }
+  ctx->async_sq=(mdadm_sqe_t*)malloc(entries*sizeof(mdadm_sqe_t));
+  ctx->async_cq=(mdadm_cqe_t*)malloc(entries*sizeof(mdadm_cqe_t));
+  ctx->async_iov=(struct iovec*)malloc(entries*sizeof(struct iovec));
+  ctx->async_order=(uint32_t*)malloc(entries*sizeof(uint32_t));
+  if(ctx->async_sq==NULL || ctx->async_cq==NULL || ctx->async_iov==NULL || ctx->async_order==NULL)
+  {
+    free(ctx->async_sq), free(ctx->async_cq), free(ctx->async_iov), free(ctx->async_order);
+    ctx->async_sq=NULL, ctx->async_cq=NULL, ctx->async_iov=NULL, ctx->async_order=NULL;
+    return -1;
+  }
+  ctx->async_entries=entries;
+  ctx->sq_head=0, ctx->sq_tail=0, ctx->cq_head=0, ctx->cq_tail=0;
+  return 1;
+}
+
+int mdadm_async_teardown(void)
+{
+  if(ctx->async_entries==0)
+  {
+    return -1;
+  }
+  free(ctx->async_sq), free(ctx->async_cq), free(ctx->async_iov), free(ctx->async_order);      //requests still queued or not reaped are dropped
+  ctx->async_sq=NULL, ctx->async_cq=NULL, ctx->async_iov=NULL, ctx->async_order=NULL;
+  ctx->async_entries=0;
+  return 1;
+}
+
+int mdadm_async_submit(const mdadm_sqe_t *sqe)
+{
+  //a request holds its slot until its completion is reaped, so the completion queue can never overflow
+  if(ctx->async_entries==0 || sqe==NULL || ctx->sq_tail-ctx->cq_head==(uint32_t)ctx->async_entries)
+  {
+    return -1;
+  }
+  ctx->async_sq[ctx->sq_tail%ctx->async_entries]=*sqe;
+  ctx->sq_tail++;
+  return 1;
+}
+
+const char *scheduler_names[MDADM_NUM_SCHEDULERS]={ "fifo", "scan", "clook" };
+
+int mdadm_scheduler_by_name(const char *name)
+{
+  for(int i=0; i<MDADM_NUM_SCHEDULERS; i++)
+  {
+    if(strcmp(name, scheduler_names[i])==0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int mdadm_async_set_scheduler(mdadm_sched_t policy)
+{
+  if(policy<0 || policy>=MDADM_NUM_SCHEDULERS)
+  {
+    return -1;
+  }
+  ctx->async_scheduler=policy;
+  return 1;
+}
+
+//true if |a| and |b| share a block and either of them writes, they have to run in the order they were submitted then
+bool sqe_conflict(const mdadm_sqe_t *a, const mdadm_sqe_t *b)
+{
+  if(a->len==0 || b->len==0 || (a->opcode==MDADM_OP_READ && b->opcode==MDADM_OP_READ))
+  {
+    return false;
+  }
+  return a->addr/256<=(b->addr+b->len-1)/256 && b->addr/256<=(a->addr+a->len-1)/256;
+}
+
+//how far along the sweep from sched_head the first block of |sqe| comes, nearer ones run first. C-LOOK goes up to the
+//highest block and starts over at the lowest, SCAN turns around and comes back down
+int sched_distance(const mdadm_sqe_t *sqe)
+{
+  int key=sqe->addr/256;
+  int blocks=JBOD_NUM_DISKS*JBOD_NUM_BLOCKS_PER_DISK;
+  if(ctx->async_scheduler==MDADM_SCHED_CLOOK)
+  {
+    return key>=ctx->sched_head ? key-ctx->sched_head : blocks+key;
+  }
+  if(ctx->sched_up)
+  {
+    return key>=ctx->sched_head ? key-ctx->sched_head : blocks+ctx->sched_head-key;
+  }
+  return key<=ctx->sched_head ? ctx->sched_head-key : blocks+key-ctx->sched_head;
+}
+
+int compare_sched_distance(const void *a, const void *b)
+{
+  uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b;
+  int dx=sched_distance(&ctx->async_sq[x%ctx->async_entries]), dy=sched_distance(&ctx->async_sq[y%ctx->async_entries]);
+  if(dx!=dy)
+  {
+    return dx<dy ? -1 : 1;
+  }
+  return (int32_t)(x-y)<0 ? -1 : 1;     //ties keep submission order
+}
+
+//fills async_order with the |n| queued submissions in the order they run. The batch is cut before every request that
+//conflicts with an earlier one since the last cut, and each stretch in between is sorted along the sweep, which then
+//carries on from where the last request of the stretch ends
+void schedule_batch(uint32_t n)
+{
+  uint32_t start=0;
+  for(uint32_t i=0; i<n; i++)
+  {
+    ctx->async_order[i]=ctx->sq_head+i;
+  }
+  if(ctx->async_scheduler==MDADM_SCHED_FIFO)
+  {
+    return;
+  }
+  for(uint32_t i=1; i<=n; i++)
+  {
+    bool cut=(i==n);
+    for(uint32_t j=start; j<i && !cut; j++)
+    {
+      cut=sqe_conflict(&ctx->async_sq[ctx->async_order[j]%ctx->async_entries], &ctx->async_sq[ctx->async_order[i]%ctx->async_entries]);
+    }
+    if(cut)
+    {
+      qsort(ctx->async_order+start, i-start, sizeof(uint32_t), compare_sched_distance);
+      mdadm_sqe_t *last=&ctx->async_sq[ctx->async_order[i-1]%ctx->async_entries];
+      int key=last->addr/256;
+      if((ctx->sched_up && key<ctx->sched_head) || (!ctx->sched_up && key>ctx->sched_head))    //the SCAN sweep turned around
       {
-        go_to_disk(get_disk_num(write_addr));  
+        ctx->sched_up=!ctx->sched_up;
       }
-      if(current_block_lbound>addr)       //checks whether the first whole block is written or just a fraction of it.
+      ctx->sched_head=(last->addr+(last->len>0 ? last->len-1 : 0))/256;
+      start=i;
+    }
+  }
+}
+
+//runs every queued submission in the order the scheduler picks and posts its completion, a failed request does not
+//stop the ones after it. The whole batch goes out before its responses are waited for, so its completions only count
+//once they are all in. They are posted in submission order whatever order the requests ran in
+void async_run(void)
+{
+  uint32_t batch_start=ctx->cq_tail, n=ctx->sq_tail-ctx->sq_head;
+  schedule_batch(n);
+  for(uint32_t k=0; k<n; k++)
+  {
+    uint32_t i=ctx->async_order[k];
+    mdadm_sqe_t *sqe=&ctx->async_sq[i%ctx->async_entries];
+    struct iovec *iov=&ctx->async_iov[i%ctx->async_entries];
+    iov->iov_base=sqe->buf, iov->iov_len=sqe->len;
+    iov_cursor_t cur={ iov, 1, 0, 0 };
+    mdadm_cqe_t *cqe=&ctx->async_cq[(ctx->cq_tail+i-ctx->sq_head)%ctx->async_entries];
+    cqe->cookie=sqe->cookie;
+    cqe->res=-1;
+    if(ctx->IS_MOUNTED==1 && iov_total(sqe->addr, iov, 1)!=-1)
+    {
+      if(sqe->opcode==MDADM_OP_READ && read_range(sqe->addr, sqe->len, &cur)==1)
       {
-        write_addr=current_block_lbound;
-      }
-      write_len=current_block_ubound-write_addr+1;
-      if(current_block_ubound>end_addr-1)     //checks wther the last whole block is written or just a fraction of it
+        cqe->res=sqe->len;
+      } else if(sqe->opcode==MDADM_OP_WRITE && write_range(sqe->addr, sqe->len, &cur)==1)
       {
-        write_len=end_addr-write_addr;
+        cqe->res=sqe->len;
       }
-      if(cache_lookup(disk_num,block_num,temporary)==-1)
-      {
-        read_block(temporary);
-        cache_insert(disk_num,block_num,temporary);  //checks in cache for specified block
-      }   
-      go_to_block(get_block_num(write_addr)); 
-      memcpy(temporary+(write_addr%256), buf+buff_idx,write_len);
-      write_block(temporary);
-      cache_update(disk_num,block_num,temporary);    //everytime write is called, update the corresponding entry in cache with new write data
-      write_addr+=write_len, buff_idx+=write_len;     //after every write, the starting write_addr is updated so that next time it will start from there
-      current_block_lbound+=256, current_block_ubound+=256;   //after current block is written, increment the current block upper and lower bound
     }
   }
-  return len;
+  ctx->sq_head+=n, ctx->cq_tail+=n;
+  if(complete_reads()==-1)
+  {
+    for(uint32_t i=batch_start; i!=ctx->cq_tail; i++)
+    {
+      ctx->async_cq[i%ctx->async_entries].res=-1;
+    }
+  }
+}
+
+int mdadm_async_peek(mdadm_cqe_t *cqe)
+{
+  if(ctx->async_entries==0 || cqe==NULL)
+  {
+    return -1;
+  }
+  if(ctx->cq_head==ctx->cq_tail)
+  {
+    return 0;
+  }
+  *cqe=ctx->async_cq[ctx->cq_head%ctx->async_entries];
+  ctx->cq_head++;
+  return 1;
+}
+
+int mdadm_async_wait(mdadm_cqe_t *cqe)
+{
+  if(ctx->async_entries==0 || cqe==NULL || (ctx->cq_head==ctx->cq_tail && ctx->sq_head==ctx->sq_tail))     //nothing in flight to wait for
+  {
+    return -1;
+  }
+  if(ctx->cq_head==ctx->cq_tail)
+  {
+    async_run();
+  }
+  return mdadm_async_peek(cqe);
 }
 
+mdadm_ctx_t *mdadm_ctx_create(void)
+{
+  mdadm_ctx_t *c=malloc(sizeof(mdadm_ctx_t));
+  if(c==NULL)
+  {
+    return NULL;
+  }
+  *c=(mdadm_ctx_t)MDADM_CTX_INIT;
+  c->cache=cache_new();
+  c->net=jbod_net_new();
+  if(c->cache==NULL || c->net==NULL)
+  {
+    cache_free(c->cache), jbod_net_free(c->net), free(c);
+    return NULL;
+  }
+  return c;
+}
+
+void mdadm_ctx_destroy(mdadm_ctx_t *c)
+{
+  //the default context is never freed
+  if(c==NULL || c==&default_ctx)
+  {
+    return;
+  }
+  mdadm_ctx_t *previous=mdadm_ctx_select(c);
+  if(ctx->async_entries!=0)
+  {
+    mdadm_async_teardown();
+  }
+  mdadm_ctx_select(previous!=c ? previous : NULL);
+  cache_free(c->cache);
+  jbod_net_free(c->net);
+  free(c);
+}
+
+mdadm_ctx_t *mdadm_ctx_select(mdadm_ctx_t *c)
+{
+  mdadm_ctx_t *previous=ctx;
+  ctx=c!=NULL ? c : &default_ctx;
+  cache_select(ctx->cache);
+  jbod_net_select(ctx->net);
+  return previous;
+}
 
 /*CWD /home/cmpsc311/sp24-lab4-mtp004 */
 /*CWD /home/cmpsc311/sp24-lab4-mtp004 */
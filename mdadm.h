@@ -2,11 +2,77 @@
 #define MDADM_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
 #include "jbod.h"
 
+/* A request for the asynchronous interface, |cookie| comes back unchanged in
+ * its completion so the caller can tell requests apart. */
+typedef enum {
+  MDADM_OP_READ,
+  MDADM_OP_WRITE,
+} mdadm_opcode_t;
+
+typedef struct {
+  mdadm_opcode_t opcode;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t *buf;
+  uint64_t cookie;
+} mdadm_sqe_t;
+
+/* |res| is what mdadm_readv or mdadm_writev would have returned. */
+typedef struct {
+  uint64_t cookie;
+  int res;
+} mdadm_cqe_t;
+
+/* The order in which a batch of async requests runs. */
+typedef enum {
+  MDADM_SCHED_FIFO,     /* submission order */
+  MDADM_SCHED_SCAN,     /* by address, sweeping up and down like an elevator */
+  MDADM_SCHED_CLOOK,    /* by address, sweeping up and starting over at the lowest */
+  MDADM_NUM_SCHEDULERS,
+} mdadm_sched_t;
+
+/* The state of one user of the JBOD: whether it is mounted, where the heads
+ * are, the async queues, read-ahead and write coalescing, along with its own
+ * connection and cache. The functions below take no context argument, so
+ * every caller and signature from before contexts stays as it was. They work
+ * on the context the calling thread selected with mdadm_ctx_select instead,
+ * or on a default one that uses the default connection and cache when it
+ * selected none. Threads that each select a context of their own can use
+ * the JBOD at the same time, as long as they do not write the same blocks;
+ * the default context is for one thread at a time. */
+typedef struct mdadm_ctx mdadm_ctx_t;
+
+/* Returns a new context, NULL on failure. Once it is selected, its
+ * connection is opened with jbod_connect_pool and its cache, if any, made
+ * with cache_create, then it is mounted, or attached to a JBOD that is
+ * mounted already with mdadm_attach. */
+mdadm_ctx_t *mdadm_ctx_create(void);
+
+/* Frees the context |c| along with its async queues, cache and connection.
+ * Nothing is flushed, that is up to mdadm_flush or mdadm_unmount first. If
+ * the calling thread still has it selected, it goes back to the default
+ * context. */
+void mdadm_ctx_destroy(mdadm_ctx_t *c);
+
+/* Makes |c| the context the calling thread works on, NULL for the default
+ * one, and selects its cache and connection too. Returns the one it
+ * replaces. */
+mdadm_ctx_t *mdadm_ctx_select(mdadm_ctx_t *c);
+
 /* Return 1 on success and -1 on failure */
 int mdadm_mount(void);
 
+/* Return 1 on success and -1 on failure. Marks the context mounted without
+ * mounting the JBOD, for a context that joins a JBOD another one mounted
+ * already; fails if the JBOD is not mounted or the context is. The context
+ * that mounted the JBOD is the one to unmount it, the others only stop
+ * using it. */
+int mdadm_attach(void);
+
 /* Return 1 on success and -1 on failure */
 int mdadm_unmount(void);
 
@@ -16,4 +82,68 @@ int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 /* Return the number of bytes written on success, -1 on failure. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Return the number of bytes read on success, -1 on failure. Reads the
+ * range starting at |addr| into the |iovcnt| buffers of |iov| in turn, the
+ * range can be any length up to the end of the JBOD. */
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt);
+
+/* Return the number of bytes written on success, -1 on failure. Writes the
+ * |iovcnt| buffers of |iov| one after another starting at |addr|. */
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt);
+
+/* Return 1 on success and -1 on failure. Turns write-back caching on or off,
+ * the cache has to be created first. While it is on, mdadm_write only updates
+ * the cache and dirty blocks are written to the JBOD when they are evicted,
+ * by mdadm_flush, or by mdadm_unmount. */
+int mdadm_set_writeback(bool enable);
+
+/* Return 1 on success and -1 on failure. Writes every dirty cached block to the JBOD. */
+int mdadm_flush(void);
+
+/* Return 1 on success and -1 on failure. Lets up to |max_blocks| blocks
+ * (at most 64) of write-through writes wait in a buffer, 0 turns that off.
+ * Writes to a block that is waiting merge into it, and each block goes out
+ * as one write when the buffer fills up, before its block is read, and on
+ * mdadm_flush or mdadm_unmount; a failure shows up there. Has no effect
+ * while write-back caching is on. */
+int mdadm_set_write_coalescing(int max_blocks);
+
+/* Return 1 on success and -1 on failure. Turns sequential read-ahead on with
+ * a window of at most |max_blocks| blocks, 0 turns it off. Once reads or
+ * writes walk through consecutive blocks, a cache miss also reads the
+ * following blocks into the cache. The window doubles while read-ahead
+ * blocks get used and halves when they are evicted unused. */
+int mdadm_set_readahead(int max_blocks);
+
+/* Return 1 on success and -1 on failure. Creates the submission and
+ * completion queues, at most |entries| requests can be submitted and not yet
+ * reaped at any time. */
+int mdadm_async_setup(int entries);
+
+/* Return 1 on success and -1 on failure. Requests that were not reaped are dropped. */
+int mdadm_async_teardown(void);
+
+/* Return 1 on success and -1 on failure. Queues a request, its buffer must
+ * stay valid until the completion is reaped. Fails when the queues are full. */
+int mdadm_async_submit(const mdadm_sqe_t *sqe);
+
+/* Return 1 on success and -1 on failure. Sets the order in which a batch of
+ * queued requests runs, FIFO until it is set. Whatever the order, a request
+ * still runs after an earlier one of the batch that touches one of its
+ * blocks if either of them writes. */
+int mdadm_async_set_scheduler(mdadm_sched_t policy);
+
+/* Returns the scheduler called |name| ("fifo", "scan" or "clook"), or -1 if
+ * there is no such scheduler. */
+int mdadm_scheduler_by_name(const char *name);
+
+/* Return 1 if a completion was stored in |cqe|, 0 if none is ready and -1 on
+ * failure. Never does any I/O. */
+int mdadm_async_peek(mdadm_cqe_t *cqe);
+
+/* Return 1 on success and -1 on failure. Stores the oldest completion in
+ * |cqe|, running the queued requests first if none is ready. Completions come
+ * back in submission order. Fails if nothing is in flight. */
+int mdadm_async_wait(mdadm_cqe_t *cqe);
+
 #endif
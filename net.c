@@ -7,53 +7,198 @@
 #include <err.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "net.h"
 #include "jbod.h"
+#include "shm_ring.h"
 
-/* the client socket descriptor for the connection to the server */
-int cli_sd = -1;
+/* a request that was sent but whose response has not been read yet */
+typedef struct {
+  uint32_t op;
+  uint8_t *block;     /* where the block of a read response goes */
+} pending_op_t;
 
-/* attempts to read n (len) bytes from fd; returns true on success and false on failure. 
-It may need to call the system call "read" multiple times to reach the given size len. 
+/* room for the responses to a full window of reads */
+#define RECV_BUF_SIZE (JBOD_MAX_WINDOW * (HEADER_LEN + JBOD_BLOCK_SIZE))
+
+/* one connection of the pool. The server answers each connection in the
+ * order it was asked, so its oldest pending request is always next on the
+ * socket. Whatever the socket has ready is received into |rbuf| at once and
+ * responses are parsed out of it from |rstart| to |rend|. A connection over
+ * shared memory has no socket and passes its packets through |chan|. */
+typedef struct {
+  int sd;
+  bool tcp;               /* TCP rather than a unix domain socket */
+  shm_channel_t *chan;
+  pending_op_t pending[JBOD_MAX_WINDOW];
+  int pending_head, pending_count;
+  uint8_t rbuf[RECV_BUF_SIZE];
+  int rstart, rend;
+} jbod_conn_t;
+
+/* one pool of connections to the server with everything sent over it */
+struct jbod_net {
+  jbod_conn_t conns[JBOD_MAX_CONNECTIONS];   /* disk d is served by conns[d % num_conns] */
+  int num_conns;
+  int window;               /* 0 until it is set or the pool connects */
+  bool pipeline_failed;     /* a send or receive went wrong since the last drain */
+  uint64_t num_requests, num_syscalls;
+  uint64_t num_bytes, num_bytes_saved;   /* packet bytes sent and received, and what encoding left out of them */
+  shm_area_t *shm_area;     /* the segment mapped when the server address names one */
+  uint16_t features;        /* JBOD_FEATURE_* bits the server announced */
+};
+
+static jbod_net_t default_net;
+static _Thread_local jbod_net_t *net = &default_net;   /* the pool the calling thread works on */
+
+/* the server does not turn Nagle off, so while one of its responses is not
+ * acknowledged it holds back the next ones. Acknowledging at once before
+ * reading keeps a window of small responses from stalling on delayed ACKs. */
+static void ack_quickly(int sd) {
+  int one = 1;
+  setsockopt(sd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+  net->num_syscalls++;
+}
+
+/* makes sure at least |len| bytes are buffered for |c|; returns true on success and false on failure.
+Every recv takes as much as the socket has ready, so one call usually brings in several responses.
 */
-static bool nread(int fd, int len, uint8_t *buf) {
-  int n_read = 0;
-  // loop to keep reading until the specified number of bytes have been read
-  while(n_read < len) {
-      // use read() system call to read the remaining bytes from fd
-    int n=read(fd, &buf[n_read], len - n_read);
-    // if read() returns a non-positive value, it indicates a failure, so return false
-    if(n==-1) 
+static bool fill(jbod_conn_t *c, int len) {
+  if(c->rend-c->rstart>=len)
+  {
+    return true;
+  }
+  if(c->rstart>0)        //move the partial response left over to the front so the rest fits behind it
+  {
+    memmove(c->rbuf, c->rbuf+c->rstart, c->rend-c->rstart);
+    c->rend-=c->rstart, c->rstart=0;
+  }
+  while(c->rend<len)
+  {
+    if(c->tcp && c->pending_count>0)      //the one being parsed is not counted any more, so more are queued behind it
+    {
+      ack_quickly(c->sd);       //the kernel drops back to delayed ACKs on its own, so this is renewed while responses queue up
+    }
+    int n=recv(c->sd, c->rbuf+c->rend, RECV_BUF_SIZE-c->rend, 0);
+    net->num_syscalls++;
+    // if recv() returns a non-positive value, it indicates a failure, so return false
+    if(n<=0) 
     {
       return false;
     }
-    n_read+=n;
+    c->rend+=n;
   }
   return true;
 }
 
-
-/* attempts to write n bytes to fd; returns true on success and false on failure 
-It may need to call the system call "write" multiple times to reach the size len.
+/* sends everything in |iov|; returns true on success and false on failure.
+It may need to call sendmsg multiple times if the socket takes only part of it.
 */
-static bool nwrite(int fd, int len, uint8_t *buf) {
-  int n_write = 0;
-  while (n_write < len) 
+static bool nsendmsg(int fd, struct iovec *iov, int iovcnt) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=iov;
+  msg.msg_iovlen=iovcnt;
+  while(msg.msg_iovlen>0)
   {
-    // use write() system call to write the remaining bytes to fd
-    int n=write(fd, &buf[n_write], len - n_write);
-    // if write() returns a non-positive value, it indicates a failure, so return false
-    if(n==-1) 
+    ssize_t n=sendmsg(fd, &msg, MSG_NOSIGNAL);
+    net->num_syscalls++;
+    if(n<=0) 
     {
       return false;
     }
-    n_write += n;
+    while(msg.msg_iovlen>0 && (size_t)n>=msg.msg_iov->iov_len)     //skip what went out, finish a partly sent piece next time
+    {
+      n-=msg.msg_iov->iov_len;
+      msg.msg_iov++, msg.msg_iovlen--;
+    }
+    if(msg.msg_iovlen>0)
+    {
+      msg.msg_iov->iov_base=(uint8_t *)msg.msg_iov->iov_base+n;
+      msg.msg_iov->iov_len-=n;
+    }
   }
   return true;
 }
 
-/* Through this function call the client attempts to receive a packet from sd 
+jbod_net_t *jbod_net_new(void) {
+  return calloc(1, sizeof(jbod_net_t));
+}
+
+void jbod_net_free(jbod_net_t *n) {
+  if(n==NULL)
+  {
+    return;
+  }
+  jbod_net_t *previous=jbod_net_select(n);
+  jbod_disconnect();
+  jbod_net_select(previous);
+  free(n);
+}
+
+jbod_net_t *jbod_net_select(jbod_net_t *n) {
+  jbod_net_t *previous=net;
+  net=n!=NULL ? n : &default_net;
+  return previous;
+}
+
+int jbod_request_payload(uint32_t op) {
+  switch((op >> 14) & 63)
+  {
+    case JBOD_WRITE_BLOCK:
+    case JBOD_SEEK_AND_WRITE:
+      return JBOD_BLOCK_SIZE;
+    case JBOD_WRITE_EXTENT:
+      return JBOD_EXTENT_BLOCKS(op)*JBOD_BLOCK_SIZE;
+    case JBOD_WRITE_PARTIAL:
+      return 1+JBOD_PARTIAL_BYTES(op);        //the offset, then the bytes
+  }
+  return 0;
+}
+
+int jbod_response_payload(uint32_t op) {
+  switch((op >> 14) & 63)
+  {
+    case JBOD_READ_BLOCK:
+    case JBOD_SEEK_AND_READ:
+    case JBOD_SIGN_BLOCK:
+      return JBOD_BLOCK_SIZE;
+    case JBOD_READ_EXTENT:
+      return JBOD_EXTENT_BLOCKS(op)*JBOD_BLOCK_SIZE;
+  }
+  return 0;
+}
+
+int jbod_encode_uniform(const uint8_t *data, int len, uint8_t *out) {
+  int n=0;
+  for(int i=0; i<len; i+=JBOD_BLOCK_SIZE)
+  {
+    if(memcmp(data+i, data+i+1, JBOD_BLOCK_SIZE-1)!=0)      //every byte equals the one after it
+    {
+      return 0;
+    }
+    out[n++]=data[i];
+  }
+  return n;
+}
+
+void jbod_decode_uniform(const uint8_t *encoded, int len, uint8_t *data) {
+  for(int i=0; i<len/JBOD_BLOCK_SIZE; i++)
+  {
+    memset(data+i*JBOD_BLOCK_SIZE, encoded[i], JBOD_BLOCK_SIZE);
+  }
+}
+
+static bool response_ready(void *chan) {
+  return shm_ring_used_slot(&((shm_channel_t *)chan)->responses)!=NULL;
+}
+
+/* Through this function call the client attempts to receive a packet from |c|
 (i.e., receiving a response from the server.). It happens after the client previously 
 forwarded a jbod operation call via a request message to the server.  
 It returns true on success and false on failure. 
@@ -63,22 +208,27 @@ op - the address to store the jbod "opcode"
 ret - the address to store the return value of the server side calling the corresponding jbod_operation function.
 block - holds the received block content if existing (e.g., when the op command is JBOD_READ_BLOCK)
 
-In your implementation, you can read the packet header first (i.e., read HEADER_LEN bytes first), 
-and then use the length field in the header to determine whether it is needed to read 
-a block of data from the server. You may use the above nread function here.  
+The header is parsed out of the receive buffer first, its length field tells whether a block follows it.
+A response flagged JBOD_PAYLOAD_UNIFORM carries a byte per block, which is expanded into |block|, and
+the flag is cleared from |op|.
 */
-static bool recv_packet(int sd, uint32_t *op, uint16_t *ret, uint8_t *block) {
-  if(sd==-1)
-  {
-    return false;
-  }
+static bool recv_packet(jbod_conn_t *c, uint32_t *op, uint16_t *ret, uint8_t *block) {
   uint16_t len;
-  uint8_t header[HEADER_LEN];       //declare array of size 8 to read the header and extract information
+  uint8_t *header;
 
-  if(nread(sd,HEADER_LEN, header)==false)      //read the header
+  if(c->chan!=NULL)       //the whole packet is already in its slot
+  {
+    net->num_syscalls+=shm_doorbell_wait(&c->chan->response_bell, response_ready, c->chan);
+    header=shm_ring_used_slot(&c->chan->responses);
+  }
+  else if(c->sd==-1 || fill(c, HEADER_LEN)==false)      //the header
   {
     return false;
   }
+  else
+  {
+    header=c->rbuf+c->rstart;
+  }
   memcpy(&len, header, sizeof(len));       //extract len
   len=ntohs(len);
 
@@ -88,111 +238,343 @@ static bool recv_packet(int sd, uint32_t *op, uint16_t *ret, uint8_t *block) {
   memcpy(op, header+2, sizeof(*op));            // extract op value
   *op=ntohl(*op);  
 
-  if(len==(HEADER_LEN+JBOD_BLOCK_SIZE) && *ret==0)      // if len is greater than 8, continue to read the block that was send.
+  bool uniform=(*op & JBOD_PAYLOAD_UNIFORM)!=0;
+  *op&=~JBOD_PAYLOAD_UNIFORM;
+  int payload=jbod_response_payload(*op);
+  int body=uniform ? payload/JBOD_BLOCK_SIZE : payload;     //what actually follows the header
+  if(len!=HEADER_LEN && (body==0 || len!=HEADER_LEN+body))
+  {
+    if(c->chan!=NULL)
+    {
+      shm_ring_release(&c->chan->responses);
+    }
+    return false;
+  }
+  if(c->chan==NULL)
   {
-    if(nread(sd,JBOD_BLOCK_SIZE,block)==false)
+    if(fill(c, len)==false)
     {
       return false;
     }
+    header=c->rbuf+c->rstart;       //filling may have moved it to the front
+  }
+  if(len==HEADER_LEN+body && body>0)      // blocks came with it
+  {
+    net->num_bytes_saved+=payload-body;
+    if(*ret==0 && block!=NULL && uniform)
+    {
+      jbod_decode_uniform(header+HEADER_LEN, payload, block);
+    }
+    else if(*ret==0 && block!=NULL)
+    {
+      memcpy(block, header+HEADER_LEN, payload);
+    }
+  }
+  net->num_bytes+=len;
+  if(c->chan!=NULL)
+  {
+    shm_ring_release(&c->chan->responses);
+  }
+  else
+  {
+    c->rstart+=len;
   }
   return true;
 }
 
 
 
-/* The client attempts to send a jbod request packet to sd (i.e., the server socket here); 
+/* The client attempts to send a jbod request packet to |c| (i.e., the server socket or its shared memory ring here); 
 returns true on success and false on failure. 
 
 op - the opcode. 
-block- when the command is JBOD_WRITE_BLOCK, the block will contain data to write to the server jbod system;
-otherwise it is NULL.
+block- when the command is JBOD_WRITE_BLOCK, the block will contain data to write to the server jbod system
+(all of its blocks for JBOD_WRITE_EXTENT); otherwise it is NULL.
 
-The above information (when applicable) has to be wrapped into a jbod request packet (format specified in readme).
-You may call the above nwrite function to do the actual sending.  
+The header and the block go out together in one sendmsg straight from where they are, without being copied into a packet first.
+Blocks that are each one byte repeated go out as just those bytes once the server announced JBOD_FEATURE_UNIFORM.
+Over shared memory they are written into the next request slot instead, which takes no system call unless the server sleeps.
 */
-static bool send_packet(int sd, uint32_t op, uint8_t *block) {
-  if(sd==-1)
+static bool send_packet(jbod_conn_t *c, uint32_t op, uint8_t *block) {
+  if(c->sd==-1 && c->chan==NULL)
   {
     return false;
   }
-  uint16_t ret=0; 
-  uint32_t cmd=(op >> 14) & 63;       //extracting the command from op
-  uint16_t len = HEADER_LEN;           
-  if(cmd == JBOD_WRITE_BLOCK) {         //if the command is write, then len include the block length
-    len += JBOD_BLOCK_SIZE;
+  int payload=jbod_request_payload(op);
+  uint8_t encoded[JBOD_MAX_EXTENT];
+  if(payload>0 && payload%JBOD_BLOCK_SIZE==0 && jbod_has_feature(JBOD_FEATURE_UNIFORM)
+     && jbod_encode_uniform(block, payload, encoded)>0)
+  {
+    op|=JBOD_PAYLOAD_UNIFORM;
+    net->num_bytes_saved+=payload-payload/JBOD_BLOCK_SIZE;
+    payload/=JBOD_BLOCK_SIZE;
+    block=encoded;
   }
-  uint8_t header[len];          // declare an array of size len
+  uint16_t len = HEADER_LEN + payload;          //if the command is write, then len include the block length
+  uint8_t header[HEADER_LEN];
   uint16_t length = htons(len);
+  uint16_t ret = htons(0);
   op = htonl(op);
-  ret=htons(ret);
-  memcpy(header, &length, sizeof(len));      //writing the necessary information into the array
+  memcpy(header, &length, sizeof(length));      //writing the necessary information into the header
   memcpy(header+2, &op, sizeof(op));
   memcpy(header+6, &ret, sizeof(ret));
-  if(cmd == JBOD_WRITE_BLOCK) {           //if the command is write then copy the block  argument into the array
-    memcpy(header+8, block, JBOD_BLOCK_SIZE);
-  }
-  if (nwrite(sd, len, header) == false) {       //write the array to server
-    return false;
+
+  net->num_requests++;
+  net->num_bytes+=len;
+  if(c->chan!=NULL)
+  {
+    uint8_t *slot=shm_ring_free_slot(&c->chan->requests);
+    if(slot==NULL || len>SHM_PACKET_LEN)        //never with a window no larger than the ring, nor for a command the server announced
+    {
+      return false;
+    }
+    memcpy(slot, header, HEADER_LEN);
+    memcpy(slot+HEADER_LEN, block, payload);
+    net->num_syscalls+=shm_ring_publish(&c->chan->requests, &net->shm_area->request_bell);
+    return true;
   }
-  return true;
+
+  struct iovec iov[2] = {
+    { .iov_base = header, .iov_len = HEADER_LEN },
+    { .iov_base = block, .iov_len = payload },
+  };
+  return nsendmsg(c->sd, iov, payload>0 ? 2 : 1);
 }
 
 
 
-/* attempts to connect to server and set the global cli_sd variable to the
- * socket; returns true if successful and false if not. 
+/* opens one stream connection to |address|, returns its socket or -1.
+ * "unix:/path" is a unix domain socket, anything else a host name or an
+ * IPv4 or IPv6 address of a TCP server listening on |port|. |tcp| tells which. */
+static int connect_one(const char *address, uint16_t port, bool *tcp) {
+  int sd;
+  *tcp=(strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX))!=0);
+  if(*tcp==false)
+  {
+    struct sockaddr_un server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family=AF_UNIX;
+    if(strlen(address+strlen(UNIX_PREFIX))>=sizeof(server_addr.sun_path) || (sd=socket(AF_UNIX, SOCK_STREAM, 0))==-1)
+    {
+      return -1;
+    }
+    strcpy(server_addr.sun_path, address+strlen(UNIX_PREFIX));
+    if(connect(sd, (const struct sockaddr*)&server_addr, sizeof(server_addr))==-1)
+    {
+      close(sd);
+      return -1;
+    }
+    return sd;
+  }
+
+  struct addrinfo hints, *res, *ai;
+  char service[8];
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family=AF_UNSPEC;
+  hints.ai_socktype=SOCK_STREAM;
+  snprintf(service, sizeof(service), "%u", port);
+  if(getaddrinfo(address, service, &hints, &res)!=0)
+  {
+    return -1;
+  }
+  sd=-1;
+  for(ai=res; ai!=NULL && sd==-1; ai=ai->ai_next)      //the first address that takes the connection
+  {
+    sd=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(sd!=-1 && connect(sd, ai->ai_addr, ai->ai_addrlen)==-1)
+    {
+      close(sd);
+      sd=-1;
+    }
+  }
+  freeaddrinfo(res);
+  if(sd!=-1)
+  {
+    int one=1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));     //requests are sent back to back, not batched up by Nagle
+  }
+  return sd;
+}
+
+/* attempts to open |n| connections to the server; returns true if successful and false if not.
  * this function will be invoked by tester to connect to the server at given ip and port.
  * you will not call it in mdadm.c
+ * |ip| may also be "unix:/path" for a unix domain socket or "shm:/name" for the shared memory segment of a server on this host, the port is not used then.
 */
-bool jbod_connect(const char *ip, uint16_t port) {
-  cli_sd=socket(AF_INET, SOCK_STREAM, 0);         //creating socket
-  if(cli_sd==-1)
+bool jbod_connect_pool(const char *ip, uint16_t port, int n) {
+  if(net->num_conns!=0 || n<1 || n>JBOD_MAX_CONNECTIONS)
   {
     return false;
   }
-  struct sockaddr_in server_addr;       //assigning address into the socket struct
-  server_addr.sin_family=AF_INET;
-  server_addr.sin_port=htons(port);
-  if(inet_aton(ip, &server_addr.sin_addr)==0)
+  if(net->window==0)
   {
-    return false;
+    net->window=JBOD_DEFAULT_WINDOW;
   }
-  if(connect(cli_sd,(const struct sockaddr*)&server_addr, sizeof(server_addr))==-1)
+  bool shared=(strncmp(ip, SHM_PREFIX, strlen(SHM_PREFIX))==0);
+  if(shared && (net->shm_area=shm_area_map(ip+strlen(SHM_PREFIX), false))==NULL)
   {
     return false;
   }
+  for(int i=0; i<n; i++)
+  {
+    net->conns[i].sd=shared ? -1 : connect_one(ip, port, &net->conns[i].tcp);
+    net->conns[i].chan=shared ? shm_channel_claim(net->shm_area) : NULL;
+    net->conns[i].pending_head=0, net->conns[i].pending_count=0;
+    net->conns[i].rstart=0, net->conns[i].rend=0;
+    if(net->conns[i].sd==-1 && net->conns[i].chan==NULL)
+    {
+      net->num_conns=i;
+      jbod_disconnect();
+      return false;
+    }
+  }
+  net->num_conns=n;
+
+  //asks the server which extensions it takes before anything else is in flight. The server
+  //only encodes responses on a connection that asked, so every connection does.
+  uint32_t op;
+  uint16_t ret;
+  for(int i=0; i<n; i++)
+  {
+    if(send_packet(&net->conns[i], JBOD_NET_FEATURES << 14, NULL)==false || recv_packet(&net->conns[i], &op, &ret, NULL)==false)
+    {
+      jbod_disconnect();
+      return false;
+    }
+  }
+  net->features=(ret==(uint16_t)-1) ? 0 : ret;
   return true;
 }
 
+bool jbod_connect(const char *ip, uint16_t port) {
+  return jbod_connect_pool(ip, port, 1);
+}
+
+/* disconnects from the server, responses still on the way are dropped */
+void jbod_disconnect(void) {
+  for(int i=0; i<net->num_conns; i++)
+  {
+    if(net->conns[i].chan!=NULL)
+    {
+      shm_channel_release(net->conns[i].chan);     //whoever claims it next waits for what is still in flight
+    }
+    else
+    {
+      close(net->conns[i].sd);
+    }
+  }
+  if(net->shm_area!=NULL)
+  {
+    shm_area_unmap(net->shm_area);
+    net->shm_area=NULL;
+  }
+  net->num_conns=0;
+  net->pipeline_failed=false;
+  net->features=0;
+}
+
+bool jbod_has_feature(uint16_t feature) {
+  return (net->features & feature)!=0;
+}
 
+int jbod_connection_for(int disk_num) {
+  return net->num_conns>0 ? disk_num%net->num_conns : 0;
+}
 
+/* reads the response to the oldest request on the wire of |c| and checks that it answers that request
+ * and that the JBOD carried it out; a read that failed leaves its block untouched */
+static bool recv_oldest(jbod_conn_t *c) {
+  pending_op_t *p = &c->pending[c->pending_head];
+  uint32_t op;
+  uint16_t ret;
 
-/* disconnects from the server and resets cli_sd */
-void jbod_disconnect(void) {
-  close(cli_sd);
-  cli_sd=-1;
+  c->pending_head = (c->pending_head + 1) % JBOD_MAX_WINDOW;
+  c->pending_count--;
+  if (recv_packet(c, &op, &ret, p->block) == false || op != p->op || ret != 0) {
+    return false;
+  }
+  return true;
 }
 
+bool jbod_set_window(int size) {
+  if (size < 1 || size > JBOD_MAX_WINDOW || jbod_client_drain() == -1) {
+    return false;
+  }
+  net->window = size;
+  return true;
+}
 
+int jbod_client_submit(uint32_t op, uint8_t *block)
+{
+  uint32_t cmd=(op >> 14) & 63;
+  if(net->num_conns==0) 
+  {
+    return -1;
+  }
+  //mounting and unmounting concern every disk, so they are ordered against the requests on all connections
+  bool barrier=(cmd==JBOD_MOUNT || cmd==JBOD_UNMOUNT);
+  if(barrier && jbod_client_drain()==-1)
+  {
+    return -1;
+  }
+  jbod_conn_t *c=&net->conns[barrier ? 0 : jbod_connection_for(op >> 28)];
+  if(c->pending_count==net->window && recv_oldest(c)==false)     //the window is full, make room by reading the oldest response
+  {
+    net->pipeline_failed=true;
+  }
+  if(send_packet(c, op, block)==false)
+  {
+    net->pipeline_failed=true;
+    return -1;
+  }
+  c->pending[(c->pending_head+c->pending_count)%JBOD_MAX_WINDOW]=(pending_op_t){ op, block };
+  c->pending_count++;
+  if(barrier)
+  {
+    return jbod_client_drain();
+  }
+  return 0;
+}
+
+int jbod_client_drain(void)
+{
+  bool ok=!net->pipeline_failed;
+  for(int i=0; i<net->num_conns; i++)      //every connection was sent its share already, the server works on them all meanwhile
+  {
+    while(net->conns[i].pending_count>0)
+    {
+      if(recv_oldest(&net->conns[i])==false)
+      {
+        ok=false;
+      }
+    }
+  }
+  net->pipeline_failed=false;
+  return ok ? 0 : -1;
+}
 
-/* sends the JBOD operation to the server (use the send_packet function) and receives 
-(use the recv_packet function) and processes the response. 
+/* sends the JBOD operation to the server and waits for its response, along
+with the responses of any requests still in flight ahead of it.
 
 The meaning of each parameter is the same as in the original jbod_operation function. 
 return: 0 means success, -1 means failure.
 */
 int jbod_client_operation(uint32_t op, uint8_t *block)
 {
-  if(cli_sd==-1) 
-  {
-    return -1;
-  }
-  uint16_t ret;
-  if(send_packet(cli_sd, op, block)==true)    //send the packet and receive the server respond.
+  if(jbod_client_submit(op, block)==-1)
   {
-    recv_packet(cli_sd, &op, &ret, block);
-    return 0;
-  } else {
+    jbod_client_drain();
     return -1;
   }
+  return jbod_client_drain();
+}
+
+void jbod_print_net_stats(void)
+{
+  fprintf(stderr, "Network: %llu requests in %llu system calls (%.2f per request)\n",
+          (unsigned long long)net->num_requests, (unsigned long long)net->num_syscalls,
+          net->num_requests ? (double)net->num_syscalls/net->num_requests : 0.0);
+  fprintf(stderr, "Network: %llu bytes in packets, %llu saved by uniform block encoding (%.1f%%)\n",
+          (unsigned long long)net->num_bytes, (unsigned long long)net->num_bytes_saved,
+          net->num_bytes+net->num_bytes_saved ? 100.0*net->num_bytes_saved/(net->num_bytes+net->num_bytes_saved) : 0.0);
 }
@@ -3,13 +3,111 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "jbod.h"
 
 #define HEADER_LEN (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t))
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
+#define UNIX_PREFIX "unix:"   /* a server address starting with this is the path of a unix domain socket */
+#define JBOD_DEFAULT_WINDOW 16   /* requests in flight before the oldest response is read */
+#define JBOD_MAX_WINDOW 64
+#define JBOD_MAX_CONNECTIONS JBOD_NUM_DISKS
+
+/* Protocol extensions on top of the jbod.h commands, only sent to a server
+ * that announced them. A server answers JBOD_NET_FEATURES with a mask of
+ * JBOD_FEATURE_* bits in the return field; an older one fails it, -1 on the
+ * wire, which counts as no features. The compound commands seek to the disk
+ * and block in their op and then read or write there, all in one request.
+ * The extent commands do the same for the number of blocks in the low bits
+ * of their op, up to JBOD_MAX_EXTENT and not past the end of the disk, and
+ * their packets carry all of those blocks. With JBOD_FEATURE_UNIFORM a
+ * packet whose blocks are each one byte repeated, like the zeros of a cold
+ * disk, may carry just that byte per block instead; JBOD_PAYLOAD_UNIFORM in
+ * its op says so. Either side only sends it once the server announced the
+ * feature on that connection. A partial write seeks to the block in its op
+ * and overwrites JBOD_PARTIAL_BYTES of it, starting at the offset in the
+ * first byte of its packet, with the bytes that follow; the rest of the
+ * block stays as it was. */
+#define JBOD_SEEK_AND_READ 32
+#define JBOD_SEEK_AND_WRITE 33
+#define JBOD_READ_EXTENT 34
+#define JBOD_WRITE_EXTENT 35
+#define JBOD_WRITE_PARTIAL 36
+#define JBOD_NET_FEATURES 63
+#define JBOD_FEATURE_COMPOUND 0x0001
+#define JBOD_FEATURE_EXTENT 0x0002
+#define JBOD_FEATURE_UNIFORM 0x0004
+#define JBOD_FEATURE_PARTIAL 0x0008
+#define JBOD_PAYLOAD_UNIFORM 0x2000
+#define JBOD_MAX_EXTENT 16
+#define JBOD_EXTENT_BLOCKS(op) ((op) & 0x1fff)
+#define JBOD_PARTIAL_BYTES(op) (((op) & 0xff) + 1)
+
+/* One pool of connections to the server. The functions below take no pool
+ * argument, they work on the pool the calling thread selected, or on a
+ * default one shared by every thread that selected none. A pool is for one
+ * thread at a time. */
+typedef struct jbod_net jbod_net_t;
+
+/* Returns a new pool with nothing connected yet, NULL on failure. */
+jbod_net_t *jbod_net_new(void);
+
+/* Disconnects the pool |n| and frees it. It must not be selected by any
+ * thread. */
+void jbod_net_free(jbod_net_t *n);
+
+/* Makes |n| the pool the calling thread works on, NULL for the default one.
+ * Returns the one it replaces. */
+jbod_net_t *jbod_net_select(jbod_net_t *n);
+
+/* Bytes of block data that follow the header of a request for |op|, and of
+ * its response when it succeeds. */
+int jbod_request_payload(uint32_t op);
+int jbod_response_payload(uint32_t op);
+
+/* Encodes the |len| bytes of blocks at |data| into |out|, one byte per
+ * block, if every block is a single byte repeated; returns the encoded
+ * length, or 0 if some block is not uniform. */
+int jbod_encode_uniform(const uint8_t *data, int len, uint8_t *out);
+/* Expands what jbod_encode_uniform made of |len| bytes back into |data|. */
+void jbod_decode_uniform(const uint8_t *encoded, int len, uint8_t *data);
 
 int jbod_client_operation(uint32_t op, uint8_t *block);
+
+/* Sends the operation without waiting for its response, returns 0 on success
+ * and -1 on failure. Once the window is full the oldest response is read
+ * first. A read response lands in |block| when it arrives, so |block| must
+ * stay valid until jbod_client_drain returns; a write block is copied when
+ * it is sent. */
+int jbod_client_submit(uint32_t op, uint8_t *block);
+
+/* Reads every outstanding response, returns 0 if all requests since the last
+ * drain went through and -1 if any failed. */
+int jbod_client_drain(void);
+
+/* Sets how many requests jbod_client_submit keeps in flight, 1 to
+ * JBOD_MAX_WINDOW. Returns false on a bad size. */
+bool jbod_set_window(int size);
 bool jbod_connect(const char *ip, uint16_t port);
 void jbod_disconnect(void);
 
+/* Opens |n| connections to the server at |ip|, which is a host name, an
+ * IPv4 or IPv6 address, "unix:/path" or "shm:/name"; the framing is the
+ * same whatever the transport. |n| is 1 to JBOD_MAX_CONNECTIONS, returns
+ * false if any of them fails. Every request is sent on the connection of the
+ * disk in its op, so the server has to keep a head position per connection;
+ * mount and unmount go out on the first one once all others are answered. */
+bool jbod_connect_pool(const char *ip, uint16_t port, int n);
+
+/* Returns which connection of the pool serves |disk_num|. */
+int jbod_connection_for(int disk_num);
+
+/* Returns true if the connected server takes the protocol extension
+ * |feature|, one of JBOD_FEATURE_*. */
+bool jbod_has_feature(uint16_t feature);
+
+/* Prints to stderr how many requests were sent, how many socket system
+ * calls it took, and how many bytes the uniform block encoding saved. */
+void jbod_print_net_stats(void);
+
 #endif
@@ -0,0 +1,642 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "net.h"
+#include "jbod.h"
+#include "tester.h"
+#include "shm_ring.h"
+
+/*
+ * JBOD server speaking the protocol of net.h on top of jbod_operation.
+ * One thread serves every client from an edge-triggered epoll loop. The
+ * JBOD has a single head, so each connection keeps its own head position
+ * and the server seeks back to it whenever another connection moved the
+ * head in between. This is what jbod_connect_pool expects. Clients on the
+ * same host can also come in over a unix domain socket (-u), or through a
+ * shared memory segment (-m) served by a second thread that takes turns
+ * with the loop on the JBOD.
+ */
+
+#define SERVER_ARGUMENTS "hp:m:u:"
+#define USAGE                                                            \
+  "USAGE: server [-h] [-p port] [-u socket_path] [-m shm_name]\n"        \
+  "\n"                                                                   \
+  "where:\n"                                                             \
+  "    -h - help mode (display this message)\n"                          \
+  "    -p - port to listen on (default 3333)\n"                          \
+  "    -u - also listen on a unix domain socket, clients use unix:path\n" \
+  "    -m - also serve clients connecting to shm:shm_name, e.g. /jbod\n"  \
+  "\n"                                                                   \
+
+#define PACKET_LEN ((int)(HEADER_LEN + JBOD_BLOCK_SIZE))
+#define MAX_PACKET_LEN ((int)(HEADER_LEN + JBOD_MAX_EXTENT * JBOD_BLOCK_SIZE))
+#define IN_BUF_SIZE (JBOD_MAX_WINDOW * PACKET_LEN)
+#define OUT_BUF_SIZE (JBOD_MAX_WINDOW * PACKET_LEN)
+#define MAX_EVENTS 64
+
+/* where the head of one connection is, -1 while unknown */
+typedef struct {
+  int disk, block;
+  unsigned mounts;        /* the value of |mounts| when it was last known */
+} head_t;
+
+/* one client. Requests are parsed out of |in| once they are complete and
+ * their responses queue up in |out| until the socket takes them. */
+typedef struct {
+  int sd;
+  head_t head;
+  uint8_t in[IN_BUF_SIZE];
+  int in_len;
+  uint8_t out[OUT_BUF_SIZE];
+  int out_start, out_len;
+  bool uniform;           /* it asked for the features, so responses may be encoded */
+  char name[64];          /* who it is, for the log */
+} client_t;
+
+static head_t *head_owner = NULL;   /* the connection the JBOD head was last moved for */
+static unsigned mounts = 0;         /* MOUNTs and UNMOUNTs so far, each puts the head back at disk 0 block 0 */
+static pthread_mutex_t jbod_lock = PTHREAD_MUTEX_INITIALIZER;   /* the JBOD and head_owner */
+static volatile sig_atomic_t stopping = 0;
+static int tcp_listener = -1, unix_listener = -1;   /* their addresses tag them in epoll events */
+static unsigned long long disk_seeks = 0, block_seeks = 0;   /* reported with the cost on exit */
+
+static void on_signal(int sig) {
+  stopping = 1;
+}
+
+static bool set_nonblocking(int sd) {
+  int flags = fcntl(sd, F_GETFL, 0);
+  return flags != -1 && fcntl(sd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
+  return cmd << 14 | disk_num << 28 | block_num << 20;
+}
+
+/* jbod_operation, counting the seeks */
+static int run_op(uint32_t op, uint8_t *block) {
+  switch ((op >> 14) & 63) {
+    case JBOD_SEEK_TO_DISK:
+      disk_seeks++;
+      break;
+    case JBOD_SEEK_TO_BLOCK:
+      block_seeks++;
+      break;
+  }
+  return jbod_operation(op, block);
+}
+
+/* moves the JBOD head to where |h| left it, if someone else moved it since */
+static void restore_head(head_t *h) {
+  if (head_owner == h || h->disk == -1) {
+    return;
+  }
+  run_op(encode_op(JBOD_SEEK_TO_DISK, h->disk, 0), NULL);
+  if (h->block != -1) {
+    run_op(encode_op(JBOD_SEEK_TO_BLOCK, 0, h->block), NULL);
+  }
+}
+
+/* runs one request for the connection with head |h| and returns what
+ * jbod_operation returned */
+static int execute(head_t *h, uint32_t op, uint8_t *block) {
+  uint32_t cmd = (op >> 14) & 63;
+  int ret;
+
+  /* a mount or unmount since |h| last ran moved the head under it */
+  if (h->mounts != mounts) {
+    h->disk = -1, h->block = -1;
+    h->mounts = mounts;
+  }
+
+  if (cmd == JBOD_SEEK_AND_READ || cmd == JBOD_SEEK_AND_WRITE || cmd == JBOD_READ_EXTENT || cmd == JBOD_WRITE_EXTENT) {
+    int disk = (op >> 28) & 15, block_num = (op >> 20) & 255;
+    int count = (cmd == JBOD_READ_EXTENT || cmd == JBOD_WRITE_EXTENT) ? JBOD_EXTENT_BLOCKS(op) : 1;
+    bool reading = (cmd == JBOD_SEEK_AND_READ || cmd == JBOD_READ_EXTENT);
+
+    if (count < 1 || count > JBOD_MAX_EXTENT || block_num + count > JBOD_NUM_BLOCKS_PER_DISK) {
+      return -1;
+    }
+    /* only the seeks the head still needs reach the JBOD */
+    if ((head_owner != h || h->disk != disk)
+        && (ret = execute(h, encode_op(JBOD_SEEK_TO_DISK, disk, 0), NULL)) != 0) {
+      return ret;
+    }
+    if ((head_owner != h || h->block != block_num)
+        && (ret = execute(h, encode_op(JBOD_SEEK_TO_BLOCK, disk, block_num), NULL)) != 0) {
+      return ret;
+    }
+    for (int i = 0; i < count; i++) {
+      ret = execute(h, encode_op(reading ? JBOD_READ_BLOCK : JBOD_WRITE_BLOCK, disk, 0), block + i * JBOD_BLOCK_SIZE);
+      if (ret != 0) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  if (cmd == JBOD_WRITE_PARTIAL) {
+    uint8_t whole[JBOD_BLOCK_SIZE];
+    int disk = (op >> 28) & 15, block_num = (op >> 20) & 255, offset = block[0];
+
+    if (offset + JBOD_PARTIAL_BYTES(op) > JBOD_BLOCK_SIZE) {
+      return -1;
+    }
+    /* the read moved the head past the block, the write seeks back to it */
+    if ((ret = execute(h, encode_op(JBOD_SEEK_AND_READ, disk, block_num), whole)) != 0) {
+      return ret;
+    }
+    memcpy(whole + offset, block + 1, JBOD_PARTIAL_BYTES(op));
+    return execute(h, encode_op(JBOD_SEEK_AND_WRITE, disk, block_num), whole);
+  }
+
+  if (cmd == JBOD_SEEK_TO_BLOCK || cmd == JBOD_READ_BLOCK || cmd == JBOD_WRITE_BLOCK) {
+    restore_head(h);
+  }
+  ret = run_op(op, block);
+  if (cmd == JBOD_SEEK_TO_DISK || cmd == JBOD_SEEK_TO_BLOCK || cmd == JBOD_READ_BLOCK || cmd == JBOD_WRITE_BLOCK) {
+    head_owner = h;
+  }
+  if (ret != 0) {
+    return ret;
+  }
+  switch (cmd) {
+    case JBOD_MOUNT:
+    case JBOD_UNMOUNT:
+      /* every head is unknown now, the next request of each connection seeks */
+      mounts++;
+      head_owner = NULL;
+      h->disk = -1, h->block = -1;
+      h->mounts = mounts;
+      break;
+    case JBOD_SEEK_TO_DISK:
+      h->disk = (op >> 28) & 15;
+      h->block = 0;
+      break;
+    case JBOD_SEEK_TO_BLOCK:
+      h->block = (op >> 20) & 255;
+      break;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      h->block = (h->block == -1 || h->block + 1 >= JBOD_NUM_BLOCKS_PER_DISK) ? -1 : h->block + 1;
+      break;
+  }
+  return ret;
+}
+
+/* returns how long the request starting at |packet| is, or -1 if it is not
+ * a request. Only the header has to be there. */
+static int request_len(const uint8_t *packet) {
+  uint16_t len;
+  uint32_t op;
+  int payload;
+
+  memcpy(&len, packet, sizeof(len));
+  memcpy(&op, packet + 2, sizeof(op));
+  len = ntohs(len);
+  op = ntohl(op);
+  payload = jbod_request_payload(op);
+  if (payload > JBOD_MAX_EXTENT * JBOD_BLOCK_SIZE
+      || ((op & JBOD_PAYLOAD_UNIFORM) && payload % JBOD_BLOCK_SIZE != 0)
+      || len != HEADER_LEN + ((op & JBOD_PAYLOAD_UNIFORM) ? payload / JBOD_BLOCK_SIZE : payload)) {
+    return -1;
+  }
+  return len;
+}
+
+/* the JBOD_FEATURE_* bit a connection needs for |cmd|, 0 for the JBOD's own commands */
+static uint16_t command_feature(uint32_t cmd) {
+  switch (cmd) {
+    case JBOD_SEEK_AND_READ:
+    case JBOD_SEEK_AND_WRITE:
+      return JBOD_FEATURE_COMPOUND;
+    case JBOD_READ_EXTENT:
+    case JBOD_WRITE_EXTENT:
+      return JBOD_FEATURE_EXTENT;
+    case JBOD_WRITE_PARTIAL:
+      return JBOD_FEATURE_PARTIAL;
+  }
+  return 0;
+}
+
+/* executes the complete request at |request| for the connection with head
+ * |h| and writes the response to |response|; returns the response length.
+ * |features| is what JBOD_NET_FEATURES gets answered with, commands that
+ * need any other feature fail, and |uniform| remembers whether that
+ * connection was told it may get encoded blocks. */
+static int handle_packet(head_t *h, bool *uniform, const uint8_t *request, uint8_t *response, uint16_t features) {
+  uint8_t block[JBOD_MAX_EXTENT * JBOD_BLOCK_SIZE];
+  uint16_t len, ret;
+  uint32_t op, cmd;
+  bool encoded_request;
+  int rc, payload, encoded = 0;
+
+  memcpy(&op, request + 2, sizeof(op));
+  op = ntohl(op);
+  encoded_request = (op & JBOD_PAYLOAD_UNIFORM) != 0;
+  op &= ~JBOD_PAYLOAD_UNIFORM;
+  cmd = (op >> 14) & 63;
+  if (command_feature(cmd) & ~features) {
+    rc = -1;    /* not offered on this connection, so its payload is not even looked at */
+  } else {
+    if (encoded_request) {
+      jbod_decode_uniform(request + HEADER_LEN, jbod_request_payload(op), block);
+    } else {
+      memcpy(block, request + HEADER_LEN, jbod_request_payload(op));
+    }
+    if (cmd == JBOD_NET_FEATURES) {
+      rc = features;
+      *uniform = (features & JBOD_FEATURE_UNIFORM) != 0;
+    } else {
+      pthread_mutex_lock(&jbod_lock);
+      rc = execute(h, op, block);
+      pthread_mutex_unlock(&jbod_lock);
+    }
+  }
+
+  /* reads and signatures carry the blocks back */
+  payload = rc == 0 ? jbod_response_payload(op) : 0;
+  if (payload > 0 && *uniform && (encoded = jbod_encode_uniform(block, payload, response + HEADER_LEN)) > 0) {
+    op |= JBOD_PAYLOAD_UNIFORM;
+    payload = encoded;
+  } else {
+    memcpy(response + HEADER_LEN, block, payload);
+  }
+  ret = htons((uint16_t)rc);
+  len = HEADER_LEN + payload;
+  uint16_t length = htons(len);
+  op = htonl(op);
+  memcpy(response, &length, sizeof(length));
+  memcpy(response + 2, &op, sizeof(op));
+  memcpy(response + 6, &ret, sizeof(ret));
+  return len;
+}
+
+/* executes every complete request in the input buffer of |c| while there is
+ * room for its response; returns false if the client sent something that is
+ * not a request. */
+static bool handle_requests(client_t *c) {
+  int pos = 0;
+
+  while (c->in_len - pos >= (int)HEADER_LEN && OUT_BUF_SIZE - c->out_start - c->out_len >= MAX_PACKET_LEN) {
+    int len = request_len(c->in + pos);
+    if (len == -1) {
+      return false;
+    }
+    if (c->in_len - pos < len) {
+      break;
+    }
+    c->out_len += handle_packet(&c->head, &c->uniform, c->in + pos, c->out + c->out_start + c->out_len,
+                                JBOD_FEATURE_COMPOUND | JBOD_FEATURE_EXTENT | JBOD_FEATURE_UNIFORM | JBOD_FEATURE_PARTIAL);
+    pos += len;
+  }
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+  return true;
+}
+
+/* writes out as much of the queued responses as the socket takes; returns
+ * false if the connection failed. */
+static bool flush_responses(client_t *c) {
+  while (c->out_len > 0) {
+    ssize_t n = send(c->sd, c->out + c->out_start, c->out_len, MSG_NOSIGNAL);
+    if (n == -1) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c->out_start += n;
+    c->out_len -= n;
+  }
+  c->out_start = 0;
+  return true;
+}
+
+/* does everything |c| is ready for. With edge-triggered events this only
+ * stops once a read or a write would block, or the connection is done;
+ * returns false in the latter case. */
+static bool serve(client_t *c) {
+  for (;;) {
+    if (!handle_requests(c) || !flush_responses(c)) {
+      return false;
+    }
+    if (c->out_len > 0) {
+      return true;    /* the socket is full, EPOLLOUT brings us back */
+    }
+    if (c->in_len == IN_BUF_SIZE) {
+      continue;       /* only possible while responses were waiting for room */
+    }
+    ssize_t n = recv(c->sd, c->in + c->in_len, IN_BUF_SIZE - c->in_len, 0);
+    if (n == 0) {
+      fprintf(stderr, "client closed connection\n");
+      return false;
+    }
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      fprintf(stderr, "reading from client failed: %s\n", strerror(errno));
+      return false;
+    }
+    c->in_len += n;
+  }
+}
+
+static void close_client(client_t *c) {
+  fprintf(stderr, "closing connection to %s\n", c->name);
+  pthread_mutex_lock(&jbod_lock);
+  if (head_owner == &c->head) {
+    head_owner = NULL;
+  }
+  pthread_mutex_unlock(&jbod_lock);
+  close(c->sd);
+  free(c);
+}
+
+/* takes every connection waiting on |listener| */
+static void accept_clients(int listener, int epfd) {
+  for (;;) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int sd = accept(listener, (struct sockaddr *)&addr, &addr_len);
+    if (sd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fprintf(stderr, "accept failed: %s\n", strerror(errno));
+      }
+      return;
+    }
+
+    client_t *c = malloc(sizeof(client_t));
+    int one = 1;
+    if (c == NULL || !set_nonblocking(sd)) {
+      free(c);
+      close(sd);
+      continue;
+    }
+    if (addr.ss_family == AF_INET6) {
+      struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+      char ip[INET6_ADDRSTRLEN];
+      snprintf(c->name, sizeof(c->name), "%s port %d", inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip)), ntohs(in6->sin6_port));
+      setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));     /* responses to a window of requests go out at once */
+    } else if (addr.ss_family == AF_INET) {
+      struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+      snprintf(c->name, sizeof(c->name), "%s port %d", inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+      setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+      snprintf(c->name, sizeof(c->name), "unix socket %d", sd);
+    }
+    c->sd = sd;
+    c->head.disk = -1, c->head.block = -1, c->head.mounts = 0;
+    c->in_len = 0;
+    c->out_start = 0, c->out_len = 0;
+    c->uniform = false;
+    fprintf(stderr, "new client connection from %s\n", c->name);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) == -1 || !serve(c)) {
+      close_client(c);
+    }
+  }
+}
+
+static bool any_request(void *arg) {
+  shm_area_t *area = arg;
+  for (int i = 0; i < JBOD_MAX_CONNECTIONS; i++) {
+    if (shm_ring_used_slot(&area->channels[i].requests) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t packet_op(const uint8_t *packet) {
+  uint32_t op;
+  memcpy(&op, packet + 2, sizeof(op));
+  return ntohl(op) & ~JBOD_PAYLOAD_UNIFORM;
+}
+
+/* answers the request at |request| with a failure and no payload */
+static void refuse_packet(const uint8_t *request, uint8_t *response) {
+  uint16_t len = htons(HEADER_LEN), ret = htons((uint16_t)-1);
+  uint32_t op = htonl(packet_op(request));
+
+  memcpy(response, &len, sizeof(len));
+  memcpy(response + 2, &op, sizeof(op));
+  memcpy(response + 6, &ret, sizeof(ret));
+}
+
+/* serves every channel of the shared memory segment |arg| */
+static void *serve_shm(void *arg) {
+  shm_area_t *area = arg;
+  head_t heads[JBOD_MAX_CONNECTIONS];
+  int32_t owners[JBOD_MAX_CONNECTIONS] = { 0 };
+  bool uniform[JBOD_MAX_CONNECTIONS] = { false };
+
+  for (;;) {
+    shm_doorbell_wait(&area->request_bell, any_request, area);
+    for (int i = 0; i < JBOD_MAX_CONNECTIONS; i++) {
+      shm_channel_t *chan = &area->channels[i];
+      uint8_t *request, *response;
+      int32_t owner = atomic_load(&chan->owner);
+
+      if (owner != owners[i]) {     /* a new client, its head is unknown */
+        pthread_mutex_lock(&jbod_lock);
+        if (head_owner == &heads[i]) {
+          head_owner = NULL;
+        }
+        pthread_mutex_unlock(&jbod_lock);
+        heads[i].disk = -1, heads[i].block = -1, heads[i].mounts = 0;
+        uniform[i] = false;
+        owners[i] = owner;
+      }
+      /* the response ring has room, a client never has more requests out than it holds */
+      while ((request = shm_ring_used_slot(&chan->requests)) != NULL
+             && (response = shm_ring_free_slot(&chan->responses)) != NULL) {
+        int len = request_len(request);
+        if (len == -1) {
+          memset(response, 0, SHM_PACKET_LEN);   /* a length the client rejects */
+        } else if (len > SHM_PACKET_LEN || HEADER_LEN + jbod_response_payload(packet_op(request)) > SHM_PACKET_LEN) {
+          refuse_packet(request, response);      /* an extent does not fit a slot */
+        } else {
+          handle_packet(&heads[i], &uniform[i], request, response,
+                        JBOD_FEATURE_COMPOUND | JBOD_FEATURE_UNIFORM | JBOD_FEATURE_PARTIAL);
+        }
+        shm_ring_publish(&chan->responses, &chan->response_bell);
+        shm_ring_release(&chan->requests);
+      }
+    }
+  }
+  return NULL;
+}
+
+/* listens on |port| for IPv6 and IPv4 clients, or IPv4 alone on a host without IPv6 */
+static int listen_on(uint16_t port) {
+  struct sockaddr_in6 addr6;
+  struct sockaddr_in addr;
+  int one = 1, zero = 0;
+  int sd = socket(AF_INET6, SOCK_STREAM, 0);
+  int bound;
+
+  if (sd == -1 && (sd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    err(1, "Failed to create a socket");
+  }
+  if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) {
+    err(1, "setsockopt failed");
+  }
+  memset(&addr6, 0, sizeof(addr6));
+  memset(&addr, 0, sizeof(addr));
+  addr6.sin6_family = AF_INET6;
+  addr6.sin6_port = htons(port);
+  addr6.sin6_addr = in6addr_any;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) == 0) {
+    bound = bind(sd, (struct sockaddr *)&addr6, sizeof(addr6));
+  } else {
+    bound = bind(sd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  if (bound == -1) {
+    err(1, "bind failed");
+  }
+  if (listen(sd, SOMAXCONN) == -1) {
+    err(1, "listen failed");
+  }
+  if (!set_nonblocking(sd)) {
+    err(1, "fcntl failed");
+  }
+  return sd;
+}
+
+static int listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (sd == -1) {
+    err(1, "Failed to create a socket");
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errx(1, "Socket path %s is too long", path);
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);     /* left over from a server that did not exit cleanly */
+  if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    err(1, "bind failed");
+  }
+  if (listen(sd, SOMAXCONN) == -1) {
+    err(1, "listen failed");
+  }
+  if (!set_nonblocking(sd)) {
+    err(1, "fcntl failed");
+  }
+  return sd;
+}
+
+int main(int argc, char *argv[]) {
+  struct epoll_event events[MAX_EVENTS];
+  struct sigaction sa;
+  int ch, port = JBOD_PORT;
+  char *shm_name = NULL, *unix_path = NULL;
+  shm_area_t *area = NULL;
+  pthread_t shm_thread;
+
+  while ((ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'm':
+        shm_name = optarg;
+        break;
+      case 'u':
+        unix_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  /* no SA_RESTART, so epoll_wait returns and the cost gets printed */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  int epfd = epoll_create1(0);
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = &tcp_listener };
+  tcp_listener = listen_on(port);
+  if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, tcp_listener, &ev) == -1) {
+    err(1, "epoll failed");
+  }
+  fprintf(stderr, "JBOD server listening on port %d...\n", port);
+  if (unix_path != NULL) {
+    unix_listener = listen_unix(unix_path);
+    ev.data.ptr = &unix_listener;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, unix_listener, &ev) == -1) {
+      err(1, "epoll failed");
+    }
+    fprintf(stderr, "JBOD server listening on %s...\n", unix_path);
+  }
+  if (shm_name != NULL) {
+    if ((area = shm_area_map(shm_name, true)) == NULL) {
+      err(1, "Failed to create shared memory %s", shm_name);
+    }
+    if (pthread_create(&shm_thread, NULL, serve_shm, area) != 0) {
+      errx(1, "Failed to start the shared memory thread");
+    }
+    pthread_detach(shm_thread);
+    fprintf(stderr, "JBOD server serving shared memory %s...\n", shm_name);
+  }
+
+  while (!stopping) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(1, "epoll_wait failed");
+    }
+    for (int i = 0; i < n; i++) {
+      client_t *c = events[i].data.ptr;
+      if (events[i].data.ptr == &tcp_listener || events[i].data.ptr == &unix_listener) {
+        accept_clients(*(int *)events[i].data.ptr, epfd);
+      } else if ((events[i].events & EPOLLERR) || !serve(c)) {
+        close_client(c);
+      }
+    }
+  }
+
+  pthread_mutex_lock(&jbod_lock);    /* the shared memory thread stays out of the JBOD from here on */
+  jbod_print_cost();
+  fprintf(stderr, "Seeks: %llu to a disk, %llu to a block\n", disk_seeks, block_seeks);
+  if (shm_name != NULL) {
+    shm_unlink(shm_name);
+  }
+  close(tcp_listener);
+  if (unix_path != NULL) {
+    close(unix_listener);
+    unlink(unix_path);
+  }
+  close(epfd);
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "shm_ring.h"
+
+#define SPIN_LIMIT 20000    /* polls before sleeping, a response usually arrives well within that */
+
+/* SPIN_LIMIT, or 0 on one CPU where spinning only keeps the other side from
+ * running. Every thread that waits may be the first to work it out. */
+static _Atomic int spin_limit = -1;
+
+/* blocks while |*word| still holds |val|. Futexes are Linux only, elsewhere
+ * this just yields and the caller polls again. */
+static void wait_on(_Atomic uint32_t *word, uint32_t val) {
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAIT, val, NULL, NULL, 0);
+#else
+  sched_yield();
+#endif
+}
+
+static void wake(_Atomic uint32_t *word) {
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+shm_area_t *shm_area_map(const char *name, bool create) {
+  int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (create && ftruncate(fd, sizeof(shm_area_t)) == -1) {
+    close(fd);
+    return NULL;
+  }
+  shm_area_t *area = mmap(NULL, sizeof(shm_area_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (area == MAP_FAILED) {
+    return NULL;
+  }
+  if (create) {
+    memset(area, 0, sizeof(shm_area_t));   /* every counter and owner starts at zero */
+    area->magic = SHM_MAGIC;
+  } else if (area->magic != SHM_MAGIC) {
+    munmap(area, sizeof(shm_area_t));
+    return NULL;
+  }
+  return area;
+}
+
+void shm_area_unmap(shm_area_t *area) {
+  munmap(area, sizeof(shm_area_t));
+}
+
+static bool requests_taken(void *arg) {
+  shm_channel_t *chan = arg;
+  return atomic_load(&chan->requests.head) == atomic_load(&chan->requests.tail);
+}
+
+shm_channel_t *shm_channel_claim(shm_area_t *area) {
+  int32_t me = getpid();
+
+  for (int i = 0; i < JBOD_MAX_CONNECTIONS; i++) {
+    shm_channel_t *chan = &area->channels[i];
+    int32_t owner = atomic_load(&chan->owner);
+    /* a channel is free, or its client died without releasing it */
+    if ((owner == 0 || (owner != me && kill(owner, 0) == -1 && errno == ESRCH))
+        && atomic_compare_exchange_strong(&chan->owner, &owner, me)) {
+      /* whatever a dead client left behind is answered first and then skipped */
+      while (!requests_taken(chan)) {
+        shm_doorbell_wait(&chan->response_bell, requests_taken, chan);
+      }
+      atomic_store(&chan->responses.head, atomic_load(&chan->responses.tail));
+      return chan;
+    }
+  }
+  return NULL;
+}
+
+void shm_channel_release(shm_channel_t *chan) {
+  atomic_store(&chan->owner, 0);
+}
+
+uint8_t *shm_ring_free_slot(shm_ring_t *r) {
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == SHM_RING_SLOTS) {
+    return NULL;
+  }
+  return r->slots[tail % SHM_RING_SLOTS];
+}
+
+int shm_ring_publish(shm_ring_t *r, shm_doorbell_t *bell) {
+  atomic_fetch_add(&r->tail, 1);
+  atomic_fetch_add(&bell->seq, 1);
+  if (atomic_load(&bell->waiting)) {     /* the consumer only sleeps after it said so */
+    wake(&bell->seq);
+    return 1;
+  }
+  return 0;
+}
+
+uint8_t *shm_ring_used_slot(shm_ring_t *r) {
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+    return NULL;
+  }
+  return r->slots[head % SHM_RING_SLOTS];
+}
+
+void shm_ring_release(shm_ring_t *r) {
+  atomic_fetch_add_explicit(&r->head, 1, memory_order_release);
+}
+
+int shm_doorbell_wait(shm_doorbell_t *bell, bool (*ready)(void *), void *arg) {
+  int syscalls = 0;
+  int limit = atomic_load_explicit(&spin_limit, memory_order_relaxed);
+
+  if (limit == -1) {
+    limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    atomic_store_explicit(&spin_limit, limit, memory_order_relaxed);
+  }
+  for (int spins = 0; !ready(arg); spins++) {
+    if (spins < limit) {
+      continue;
+    }
+    /* a publish after |seq| was read changes it, so the futex will not sleep through it */
+    uint32_t seq = atomic_load(&bell->seq);
+    atomic_store(&bell->waiting, 1);
+    if (!ready(arg)) {
+      wait_on(&bell->seq, seq);
+      syscalls++;
+    }
+    atomic_store(&bell->waiting, 0);
+    spins = 0;
+  }
+  return syscalls;
+}
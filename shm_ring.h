@@ -0,0 +1,74 @@
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "net.h"
+#include "jbod.h"
+
+/*
+ * Shared memory transport between a client and a server on the same host.
+ * The segment holds one channel per pool connection, each a request ring
+ * the client fills and a response ring the server fills. Every ring has a
+ * single producer and a single consumer, and its slots hold packets in the
+ * same format as on the socket, so both ends reuse the framing of net.h.
+ */
+
+#define SHM_PREFIX "shm:"            /* a server address starting with this names a segment */
+/* A full window never overflows a ring, even counting the request the
+ * server answered but has not released yet. A power of two, so the free
+ * running indices wrap around cleanly. */
+#define SHM_RING_SLOTS (2 * JBOD_MAX_WINDOW)
+#define SHM_PACKET_LEN (HEADER_LEN + JBOD_BLOCK_SIZE)
+#define SHM_MAGIC 0x4a424f44
+
+/* lets the consumer of a ring sleep until the producer publishes */
+typedef struct {
+  _Alignas(64) _Atomic uint32_t seq;
+  _Atomic uint32_t waiting;
+} shm_doorbell_t;
+
+typedef struct {
+  _Alignas(64) _Atomic uint32_t head;   /* next slot the consumer takes */
+  _Alignas(64) _Atomic uint32_t tail;   /* next slot the producer fills */
+  uint8_t slots[SHM_RING_SLOTS][SHM_PACKET_LEN];
+} shm_ring_t;
+
+typedef struct {
+  _Atomic int32_t owner;          /* pid of the client using the channel, 0 when free */
+  shm_ring_t requests, responses;
+  shm_doorbell_t response_bell;   /* the client waits here */
+} shm_channel_t;
+
+typedef struct {
+  uint32_t magic;
+  shm_doorbell_t request_bell;    /* the server waits here for any channel */
+  shm_channel_t channels[JBOD_MAX_CONNECTIONS];
+} shm_area_t;
+
+/* Maps the segment |name|, creating it first if |create| is set. Returns
+ * NULL on failure. */
+shm_area_t *shm_area_map(const char *name, bool create);
+void shm_area_unmap(shm_area_t *area);
+
+/* Claims a free channel for this process, NULL if there is none. */
+shm_channel_t *shm_channel_claim(shm_area_t *area);
+void shm_channel_release(shm_channel_t *chan);
+
+/* The producer fills the slot shm_ring_free_slot returns, NULL while the
+ * ring is full, and hands it over with shm_ring_publish, which returns the
+ * number of system calls it took to wake the consumer. */
+uint8_t *shm_ring_free_slot(shm_ring_t *r);
+int shm_ring_publish(shm_ring_t *r, shm_doorbell_t *bell);
+
+/* The consumer reads the slot shm_ring_used_slot returns, NULL while the
+ * ring is empty, and gives it back with shm_ring_release. */
+uint8_t *shm_ring_used_slot(shm_ring_t *r);
+void shm_ring_release(shm_ring_t *r);
+
+/* Waits until |ready| returns true for |arg|, spinning a while before going
+ * to sleep on |bell|. Returns the number of system calls it took. */
+int shm_doorbell_wait(shm_doorbell_t *bell, bool (*ready)(void *), void *arg);
+
+#endif
@@ -10,6 +10,9 @@
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "cache.h"
 #include "jbod.h"
@@ -18,19 +21,56 @@
 #include "tester.h"
 #include "net.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
-#define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
-  "\n"                                                      \
-  "where:\n"                                                \
-  "    -h - help mode (display this message)\n"             \
-  "\n"                                                      \
+#define TESTER_ARGUMENTS "hw:s:p:abm:r:vq:o:i:c:e:t:"
+#define USAGE                                                                                          \
+  "USAGE: test [-h] [-w workload-file] [-s cache_size] [-p cache_policy] [-a] [-b] [-m max_blocks] [-r max_blocks] [-v] [-q depth] [-o scheduler] [-i window] [-c connections] [-e server] [-t threads]\n" \
+  "\n"                                                                                                 \
+  "where:\n"                                                                                           \
+  "    -h - help mode (display this message)\n"                                                        \
+  "    -p - cache replacement policy: lru (default), arc, 2q, clock, lfu\n"                            \
+  "    -a - put the TinyLFU admission filter in front of the cache\n"                                  \
+  "    -b - write-back caching, writes reach the JBOD on eviction or flush\n"                          \
+  "    -m - coalesce write-through writes to up to max_blocks blocks before sending them\n"          \
+  "    -r - sequential read-ahead of up to max_blocks blocks into the cache\n"                         \
+  "    -v - issue READ and WRITE through mdadm_readv/mdadm_writev with a scattered buffer\n"           \
+  "    -q - replay READ and WRITE through the async interface with up to depth requests in flight\n"   \
+  "    -o - order of an async batch: fifo (default), scan, clook\n"                                    \
+  "    -i - JBOD requests the client sends before waiting for a response (1 - 64, default 16)\n"       \
+  "    -c - connections to the server, disks are spread over them (needs a server that allows it)\n"   \
+  "    -e - server address: a host, or unix:/path or shm:/name for a server on this host\n"            \
+  "    -t - stress test instead of a workload, threads with a context each check disks of their own\n" \
+  "\n"                                                                                                 \
 
-int run_workload(char *workload, int cache_size);
+int run_workload(char *workload, int cache_size, cache_policy_t cache_policy, bool admission, bool writeback, bool vectored, int queue_depth, mdadm_sched_t scheduler);
+
+/* What every stress test thread sets its context up with. */
+typedef struct {
+  const char *server;
+  int window;
+  int cache_size;
+  cache_policy_t cache_policy;
+  bool writeback;
+  int readahead;
+  int coalesce;
+} stress_config_t;
+
+int run_stress(int threads, const stress_config_t *config);
 
 int main(int argc, char *argv[])
 {
   int ch, cache_size = 0;
+  int cache_policy = CACHE_POLICY_LRU;
+  bool admission = false;
+  bool writeback = false;
+  bool vectored = false;
+  int queue_depth = 0;
+  int scheduler = MDADM_SCHED_FIFO;
+  int window = JBOD_DEFAULT_WINDOW;
+  int connections = 1;
+  const char *server = JBOD_SERVER;
+  int readahead = 0;
+  int coalesce = 0;
+  int threads = 0;
   char *workload = NULL;
 
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
@@ -44,21 +84,93 @@ int main(int argc, char *argv[])
       case 'w':
         workload = optarg;
         break;
+      case 'p':
+        cache_policy = cache_policy_by_name(optarg);
+        if (cache_policy == -1) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'a':
+        admission = true;
+        break;
+      case 'b':
+        writeback = true;
+        break;
+      case 'm':
+        coalesce = atoi(optarg);
+        break;
+      case 'r':
+        readahead = atoi(optarg);
+        break;
+      case 'v':
+        vectored = true;
+        break;
+      case 'q':
+        queue_depth = atoi(optarg);
+        break;
+      case 'o':
+        scheduler = mdadm_scheduler_by_name(optarg);
+        if (scheduler == -1) {
+          fprintf(stderr, "Unknown scheduler (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'i':
+        window = atoi(optarg);
+        break;
+      case 'c':
+        connections = atoi(optarg);
+        break;
+      case 'e':
+        server = optarg;
+        break;
+      case 't':
+        threads = atoi(optarg);
+        if (threads < 1 || threads > JBOD_NUM_DISKS) {
+          fprintf(stderr, "Bad number of threads (%d), aborting.\n", threads);
+          return -1;
+        }
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
     }
   }
 
-  if (!workload) {
+  if (!workload && !threads) {
     fprintf(stderr, USAGE);
     return -1;
   }
 
-  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
+  if (!jbod_connect_pool(server, JBOD_PORT, connections)) {
+    fprintf(stderr, "Failed to open %d connections to %s, aborting.\n", connections, server);
+    return -1;
+  }
+
+  if (!jbod_set_window(window)) {
+    fprintf(stderr, "Bad request window (%d), aborting.\n", window);
+    return -1;
+  }
+
+  if (readahead && mdadm_set_readahead(readahead) != 1) {
+    fprintf(stderr, "Bad read-ahead window (%d), aborting.\n", readahead);
+    return -1;
+  }
+
+  if (coalesce && mdadm_set_write_coalescing(coalesce) != 1) {
+    fprintf(stderr, "Bad write coalescing buffer (%d), aborting.\n", coalesce);
     return -1;
-  
-  run_workload(workload, cache_size);
+  }
+
+  if (threads) {
+    stress_config_t config = { server, window, cache_size, cache_policy, writeback, readahead, coalesce };
+    int rc = run_stress(threads, &config);
+    jbod_disconnect();
+    return rc;
+  }
+
+  run_workload(workload, cache_size, cache_policy, admission, writeback, vectored, queue_depth, scheduler);
   jbod_disconnect();
 
   return 0;
@@ -80,33 +192,133 @@ uint32_t op = 0;
   return op;
 }
 
-int run_workload(char *workload, int cache_size) {
+/* Cuts |buf| into three uneven pieces, so blocks straddle two of them. */
+static int scatter(uint8_t *buf, uint32_t len, struct iovec *iov) {
+  uint32_t cut1 = len / 3, cut2 = len - len / 5;
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = cut1;
+  iov[1].iov_base = buf + cut1;
+  iov[1].iov_len = cut2 - cut1;
+  iov[2].iov_base = buf + cut2;
+  iov[2].iov_len = len - cut2;
+  return 3;
+}
+
+static int do_read(uint32_t addr, uint32_t len, uint8_t *buf, bool vectored) {
+  struct iovec iov[3];
+
+  if (!vectored)
+    return mdadm_read(addr, len, buf);
+  return mdadm_readv(addr, iov, scatter(buf, len, iov));
+}
+
+static int do_write(uint32_t addr, uint32_t len, uint8_t *buf, bool vectored) {
+  struct iovec iov[3];
+
+  if (!vectored)
+    return mdadm_write(addr, len, buf);
+  return mdadm_writev(addr, iov, scatter(buf, len, iov));
+}
+
+/* An async request in flight, its address is the cookie. */
+typedef struct {
+  uint8_t *buf;
+  int line_num;
+  char line[256];
+} replay_req_t;
+
+static int async_in_flight = 0;
+
+static void async_reap(void) {
+  mdadm_cqe_t cqe;
+  replay_req_t *req;
+
+  if (mdadm_async_wait(&cqe) != 1)
+    errx(1, "Failed to wait for an async completion.");
+  req = (replay_req_t *)(uintptr_t)cqe.cookie;
+  if (cqe.res == -1)
+    errx(1, "tester failed when processing command [%s] on line %d", req->line, req->line_num);
+  free(req->buf);
+  free(req);
+  --async_in_flight;
+}
+
+/* MOUNT, UNMOUNT and SIGNALL must see every earlier request done. */
+static void async_drain(void) {
+  while (async_in_flight > 0)
+    async_reap();
+}
+
+static int async_submit(mdadm_opcode_t opcode, uint32_t addr, uint32_t len, uint8_t ch,
+                        const char *line, int line_num, int queue_depth) {
+  mdadm_sqe_t sqe;
+  replay_req_t *req = malloc(sizeof(replay_req_t));
+
+  if (async_in_flight == queue_depth)
+    async_reap();
+  if (!req || !(req->buf = malloc(len ? len : 1)))
+    errx(1, "Failed to allocate an async request.");
+  req->line_num = line_num;
+  snprintf(req->line, sizeof(req->line), "%s", line);
+  if (opcode == MDADM_OP_WRITE)
+    memset(req->buf, ch, len);
+
+  sqe.opcode = opcode;
+  sqe.addr = addr;
+  sqe.len = len;
+  sqe.buf = req->buf;
+  sqe.cookie = (uintptr_t)req;
+  if (mdadm_async_submit(&sqe) != 1)
+    return -1;
+  ++async_in_flight;
+  return 1;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int run_workload(char *workload, int cache_size, cache_policy_t cache_policy, bool admission, bool writeback, bool vectored, int queue_depth, mdadm_sched_t scheduler) {
   char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
+  static uint8_t buf[JBOD_NUM_DISKS * JBOD_DISK_SIZE];   /* READV and WRITEV can cover every disk */
   uint32_t addr, len, ch;
   int rc;
 
-  memset(buf, 0, MAX_IO_SIZE);
-
   FILE *f = fopen(workload, "r");
   if (!f)
     err(1, "Cannot open workload file %s", workload);
 
   if (cache_size) {
-    rc = cache_create(cache_size);
+    rc = cache_create_with_policy(cache_size, cache_policy);
     if (rc != 1)
       errx(1, "Failed to create cache.");
+    if (admission && cache_set_admission(true) != 1)
+      errx(1, "Failed to enable cache admission.");
+    if (writeback && mdadm_set_writeback(true) != 1)
+      errx(1, "Failed to enable write-back caching.");
   }
+  if (queue_depth && mdadm_async_setup(queue_depth) != 1)
+    errx(1, "Failed to set up async queues of depth %d.", queue_depth);
+  if (mdadm_async_set_scheduler(scheduler) != 1)
+    errx(1, "Failed to set the async scheduler.");
 
-  int line_num = 0;
+  int line_num = 0, requests = 0;
+  double start = now_seconds();
   while (fgets(line, 256, f)) {
     ++line_num;
     line[strlen(line)-1] = '\0';
     if (equals(line, "MOUNT")) {
+      async_drain();
       rc = mdadm_mount();
     } else if (equals(line, "UNMOUNT")) {
+      async_drain();
       rc = mdadm_unmount();
     } else if (equals(line, "SIGNALL")) {
+      async_drain();
+      rc = mdadm_flush();   /* signatures must reflect every write */
       for (int i = 0; i < JBOD_NUM_DISKS; ++i)
         for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
           uint8_t b[JBOD_BLOCK_SIZE];
@@ -114,13 +326,22 @@ int run_workload(char *workload, int cache_size) {
           fprintf(stdout, "%s", b);
         }
     } else {
-      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+      if (sscanf(line, "%7s %7u %7u %3u", cmd, &addr, &len, &ch) != 4 || len > sizeof(buf))
         errx(1, "Failed to parse command: [%s\n], aborting.", line);
-      if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
+      ++requests;
+      if (queue_depth && (equals(cmd, "READ") || equals(cmd, "WRITE"))) {   /* READV and WRITEV too */
+        rc = async_submit(equals(cmd, "READ") ? MDADM_OP_READ : MDADM_OP_WRITE, addr, len, ch,
+                          line, line_num, queue_depth);
+      } else if (equals(cmd, "READV")) {
+        rc = do_read(addr, len, buf, true);
+      } else if (equals(cmd, "WRITEV")) {
+        memset(buf, ch, len);
+        rc = do_write(addr, len, buf, true);
+      } else if (equals(cmd, "READ")) {
+        rc = do_read(addr, len, buf, vectored);
       } else if (equals(cmd, "WRITE")) {
         memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
+        rc = do_write(addr, len, buf, vectored);
       } else {
         errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
       }
@@ -129,13 +350,170 @@ int run_workload(char *workload, int cache_size) {
     if (rc == -1)
       errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
   }
+  async_drain();
   fclose(f);
 
-  if (cache_size)
-    cache_destroy();
+  if (queue_depth) {
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "Async replay: %d requests at depth %d in %.3f s (%.0f requests/s)\n",
+            requests, queue_depth, elapsed, requests / elapsed);
+    mdadm_async_teardown();
+  }
 
   jbod_print_cost();
   cache_print_hit_rate();
+  jbod_print_net_stats();
+
+  if (cache_size)
+    cache_destroy();
 
   return 0;
 }
+
+#define STRESS_OPS 4000        /* reads and writes per thread */
+#define STRESS_MAX_LEN 1024    /* the most mdadm_read and mdadm_write take */
+
+/* A stress test thread works on disks |id|, |id|+|threads| and so on, which
+ * no other thread touches, and keeps what they should hold in |shadow|. */
+typedef struct {
+  pthread_t thread;
+  int id, threads;
+  const stress_config_t *config;
+  uint8_t *shadow;
+  int ops, mismatches;
+  const char *error;
+} stress_thread_t;
+
+static uint32_t stress_addr(const stress_thread_t *t, int disk, uint32_t offset) {
+  return (t->id + disk * t->threads) * JBOD_DISK_SIZE + offset;
+}
+
+/* Reads |len| bytes at |offset| of the thread's |disk| and counts a
+ * mismatch unless they equal the shadow copy. */
+static int stress_check(stress_thread_t *t, int disk, uint32_t offset, uint32_t len, bool vectored) {
+  static _Thread_local uint8_t buf[JBOD_DISK_SIZE];
+
+  if (do_read(stress_addr(t, disk, offset), len, buf, vectored) != (int)len)
+    return -1;
+  if (memcmp(buf, t->shadow + disk * JBOD_DISK_SIZE + offset, len) != 0)
+    ++t->mismatches;
+  return 1;
+}
+
+static const char *stress_setup(const stress_config_t *c) {
+  if (!jbod_connect_pool(c->server, JBOD_PORT, 1))
+    return "failed to connect";
+  if (!jbod_set_window(c->window))
+    return "bad request window";
+  if (c->cache_size && cache_create_with_policy(c->cache_size, c->cache_policy) != 1)
+    return "failed to create a cache";
+  if (c->cache_size && c->writeback && mdadm_set_writeback(true) != 1)
+    return "failed to enable write-back caching";
+  if (c->readahead && mdadm_set_readahead(c->readahead) != 1)
+    return "bad read-ahead window";
+  if (c->coalesce && mdadm_set_write_coalescing(c->coalesce) != 1)
+    return "bad write coalescing buffer";
+  if (mdadm_attach() != 1)    /* the main thread mounted the JBOD */
+    return "failed to attach";
+  return NULL;
+}
+
+static void *stress_thread(void *arg) {
+  stress_thread_t *t = arg;
+  int disks = (JBOD_NUM_DISKS - t->id + t->threads - 1) / t->threads;
+  unsigned int seed = t->id + 1;
+  uint8_t buf[STRESS_MAX_LEN];
+  struct iovec iov;
+  mdadm_ctx_t *ctx = mdadm_ctx_create();
+
+  if (!ctx) {
+    t->error = "failed to create a context";
+    return NULL;
+  }
+  mdadm_ctx_select(ctx);
+  if ((t->error = stress_setup(t->config)))
+    goto out;
+
+  /* whatever the disks held before is the starting point */
+  for (int d = 0; d < disks; ++d) {
+    iov.iov_base = t->shadow + d * JBOD_DISK_SIZE;
+    iov.iov_len = JBOD_DISK_SIZE;
+    if (mdadm_readv(stress_addr(t, d, 0), &iov, 1) != JBOD_DISK_SIZE) {
+      t->error = "failed to read";
+      goto out;
+    }
+  }
+
+  for (t->ops = 0; t->ops < STRESS_OPS; ++t->ops) {
+    int d = rand_r(&seed) % disks;
+    uint32_t len = 1 + rand_r(&seed) % STRESS_MAX_LEN;
+    uint32_t offset = rand_r(&seed) % (JBOD_DISK_SIZE - len);   /* mdadm_read stops short of the last byte of the JBOD */
+    bool vectored = rand_r(&seed) % 2;
+
+    if (rand_r(&seed) % 2) {
+      for (uint32_t i = 0; i < len; ++i)
+        buf[i] = rand_r(&seed);
+      if (do_write(stress_addr(t, d, offset), len, buf, vectored) != (int)len) {
+        t->error = "failed to write";
+        goto out;
+      }
+      memcpy(t->shadow + d * JBOD_DISK_SIZE + offset, buf, len);
+    } else if (stress_check(t, d, offset, len, vectored) != 1) {
+      t->error = "failed to read";
+      goto out;
+    }
+  }
+
+  /* once flushed, every write has to be on the disks themselves, not just in the cache */
+  if (mdadm_flush() != 1) {
+    t->error = "failed to flush";
+    goto out;
+  }
+  if (t->config->cache_size)
+    cache_destroy();
+  for (int d = 0; d < disks; ++d)
+    if (stress_check(t, d, 0, JBOD_DISK_SIZE, true) != 1) {
+      t->error = "failed to read";
+      goto out;
+    }
+
+out:
+  mdadm_ctx_destroy(ctx);
+  return NULL;
+}
+
+/* Runs |threads| stress test threads at once and reports what they found.
+ * Returns 0 if every read matched what was written, -1 otherwise. */
+int run_stress(int threads, const stress_config_t *config) {
+  stress_thread_t t[JBOD_NUM_DISKS];
+  int ops = 0, mismatches = 0, failed = 0;
+
+  if (mdadm_mount() != 1)
+    errx(1, "Failed to mount.");
+
+  double start = now_seconds();
+  for (int i = 0; i < threads; ++i) {
+    t[i] = (stress_thread_t){ .id = i, .threads = threads, .config = config };
+    if (!(t[i].shadow = malloc(JBOD_DISK_SIZE * ((JBOD_NUM_DISKS + threads - 1) / threads))))
+      errx(1, "Failed to allocate a shadow copy.");
+    if (pthread_create(&t[i].thread, NULL, stress_thread, &t[i]) != 0)
+      errx(1, "Failed to start thread %d.", i);
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(t[i].thread, NULL);
+    if (t[i].error) {
+      fprintf(stderr, "Thread %d %s after %d operations\n", i, t[i].error, t[i].ops);
+      ++failed;
+    }
+    ops += t[i].ops;
+    mismatches += t[i].mismatches;
+    free(t[i].shadow);
+  }
+  double elapsed = now_seconds() - start;
+
+  if (mdadm_unmount() != 1)
+    errx(1, "Failed to unmount.");
+  fprintf(stderr, "Stress test: %d threads, %d operations in %.3f s, %d mismatched reads, %d threads failed\n",
+          threads, ops, elapsed, mismatches, failed);
+  return mismatches || failed ? -1 : 0;
+}